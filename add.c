@@ -9,6 +9,9 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
 #include <assert.h>
 
 #define INPUT_WIDTH 40
@@ -24,6 +27,7 @@ enum {
   STATE_COUNT,
 };
 
+static Journal* journal; // Of the session, which the transaction is added to.
 static Transaction transaction;
 static int state;
 static bool use_reference;
@@ -31,7 +35,20 @@ static char description_buffer[1024];
 static char reference_buffer[1024];
 static bool got_reference;
 
+static int next_index; // Of the next reference, 0 if the references directory must be read.
+static struct timespec next_index_time; // Modification time of the references directory when the index was found.
+
+void add_references_changed() {
+  next_index = 0;
+}
+
+// Other sessions add references as well, so the cached index is only used while the directory is unchanged.
 int get_next_index() {
+  struct stat info;
+  assert(stat(REFS_PATH, &info) == 0);
+
+  if (next_index && info.st_mtim.tv_sec == next_index_time.tv_sec && info.st_mtim.tv_nsec == next_index_time.tv_nsec) return next_index;
+
   int max = 0;
 
   DIR* dir = opendir(REFS_PATH);
@@ -51,20 +68,45 @@ int get_next_index() {
   }
 
   closedir(dir);
-  return max + 1;
+  next_index = max + 1;
+  next_index_time = info.st_mtim;
+  return next_index;
 }
 
+// Copies the reference file to the next free index. The references directory is locked while the index is found and the file is
+// created, such that two sessions do not take the same index.
 int copy_reference() {
   int ref_size = strlen(reference_buffer);
   char* ext = reference_buffer + ref_size - 1;
   while (ext != reference_buffer && *ext != '.') ext--;
-  int index = get_next_index();
 
+  int refs = open(REFS_PATH, O_RDONLY | O_DIRECTORY);
+  assert(refs >= 0);
+  assert(flock(refs, LOCK_EX) == 0);
+
+  int index;
   char dest_path[2000];
-  snprintf(dest_path, 2000, "%s/%d%s", REFS_PATH, index, ext);
+  int dest;
+
+  while (true) {
+    index = get_next_index();
+    snprintf(dest_path, 2000, "%s/%d%s", REFS_PATH, index, ext);
+
+    dest = open(dest_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (dest >= 0) break;
+
+    assert(errno == EEXIST);
+    next_index = 0;
+  }
+
+  struct stat info;
+  assert(fstat(refs, &info) == 0);
+  next_index = index + 1;
+  next_index_time = info.st_mtim;
+  close(refs);
 
   FILE* source_file = fopen(reference_buffer, "rb");
-  FILE* dest_file = fopen(dest_path, "wb");
+  FILE* dest_file = fdopen(dest, "wb");
 
   assert(source_file);
   assert(dest_file);
@@ -83,7 +125,8 @@ int copy_reference() {
   return index;
 }
 
-void add_transaction_init() {
+void add_transaction_init(Journal* session_journal) {
+    journal = session_journal;
     state = STATE_DATE;
     input_update_width(INPUT_WIDTH, 2);
     set_suggestions_minimum_index(0);
@@ -173,9 +216,7 @@ static void account_update(bool enter) {
     char* suggestion = get_suggestion();
     if (!suggestion) return;
 
-    Account* account = get_account(suggestion);
-    debug("Searching for account : %s\n", suggestion);
-    debug("found account: %d\n", account->index);
+    Account* account = get_account(journal, suggestion);
     if (account && account->is_category == false) {
       if (state == STATE_FROM) {
         transaction.from = account->index;
@@ -188,7 +229,7 @@ static void account_update(bool enter) {
     }
   }
   
-  suggest_account(input.data, false);
+  suggest_account(journal, input.data, false);
 }
 
 static void description_update(bool enter) {
@@ -198,19 +239,18 @@ static void description_update(bool enter) {
       input_replace(suggestion, input.size, 0);
     } else {
       strcpy(description_buffer, input.data);
-      transaction.description = description_buffer;
       state = STATE_CONFIRM;
     }
     return;
   } else {
-    suggest_description(input.data);
+    suggest_description(journal, input.data);
   }
 }
 
 static void confirm_update(bool enter) {
   if (enter) {
     if (got_reference) transaction.reference = copy_reference();
-    journal_append_transaction(&transaction);
+    journal_append_transaction(journal, &transaction, description_buffer);
 
     print("\n");
     set_x_cursor(0);
@@ -312,7 +352,7 @@ int add_transaction_render(int x) {
         print_faint("from account");
       }
     } else {
-      cursor += print("%s", journal.accounts[transaction.from].path);
+      cursor += print("%s", journal->accounts[transaction.from].path);
     }
   }
 
@@ -328,7 +368,7 @@ int add_transaction_render(int x) {
         print_faint("to account");
       }
     } else {
-      cursor += print("%s", journal.accounts[transaction.to].path);
+      cursor += print("%s", journal->accounts[transaction.to].path);
     }
   }
 
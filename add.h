@@ -2,9 +2,11 @@
 #define ADD_H
 
 #include "stdbool.h"
+#include "journal.h"
 
 bool add_transaction_update(int keycode);
 int add_transaction_render(int x);
-void add_transaction_init();
+void add_transaction_init(Journal* journal);
+void add_references_changed();
 
 #endif
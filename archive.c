@@ -0,0 +1,536 @@
+#include "archive.h"
+#include "journal.h"
+#include "lz.h"
+#include "text.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Closed years can be moved out of the journal into an archive segment next to it. The segment has a compressed block per month with the
+// transaction entries of that month, and an index with the date range and the net amount per account of every block. Only the index is
+// read when the journal is parsed. Balances are summed from the index, and the entries of a block are parsed into the journal when a
+// query needs the transactions of that month.
+//
+// Segment: header, account paths, block entries sorted by last date, then the compressed blocks.
+//
+// The segment is replaced before the journal file. Until the journal is replaced as well, the header names the journal file the year was
+// archived from, and the transactions in it up to the end of the year are skipped when it is parsed or archived, since they are in the
+// segment already. This state is left when archiving is interrupted between the two.
+
+#define ARCHIVE_MAGIC      "CASHARC2"
+
+typedef struct {
+  char  magic[8];
+  int   account_count;
+  int   block_count;
+  Date  end;            // The last archived year ends at the date.
+  ino_t journal_inode;  // The journal file that the year was archived from while it was not replaced yet, zero afterwards.
+  long  journal_size;   // Size of the journal file when the year was archived from it.
+} SegmentHeader;
+
+typedef struct {
+  Date first;
+  Date last;
+  int  count;
+  int  size;     // Compressed.
+  int  raw_size;
+  long offset;   // In the segment file.
+  double sums[MAX_ACCOUNTS]; // By account of the segment.
+} BlockEntry;
+
+// A block while the segment is written, either copied from the old segment or made from the journal.
+typedef struct {
+  BlockEntry entry;
+  u8*  data;
+  bool copied; // The data points into the old segment.
+  int  order;
+} NewBlock;
+
+typedef struct {
+  Date  date;
+  char* line;
+  int   length;
+  int   order; // Position in the file, such that a block keeps the file order.
+} ArchivedLine;
+
+// The index of the archive of a journal.
+struct Archive {
+  struct stat   opened; // The archive the index was read from, zero if there was none.
+  SegmentHeader opened_header;
+  ArchiveBlock  blocks[MAX_ARCHIVE_BLOCKS];
+  BlockEntry    entries[MAX_ARCHIVE_BLOCKS];
+  int           block_count;
+};
+
+Archive* archive_create() {
+  Archive* archive = calloc(1, sizeof(Archive));
+  assert(archive);
+  return archive;
+}
+
+// The archive is next to the journal, with its name followed by .archive.
+static char* archive_path(Journal* journal, char* path) {
+  int size = snprintf(path, PATH_MAX, "%s.archive", journal->path);
+  assert(size < PATH_MAX);
+  return path;
+}
+
+static char* read_file(char* path, long* size) {
+  FILE* file = fopen(path, "rb");
+  if (!file) return 0;
+
+  assert(fseek(file, 0, SEEK_END) == 0);
+  *size = ftell(file);
+  assert(*size >= 0);
+  assert(fseek(file, 0, SEEK_SET) == 0);
+
+  char* data = malloc(*size + 1);
+  assert(data);
+  assert(fread(data, 1, *size, file) == (size_t)*size);
+  data[*size] = 0;
+  fclose(file);
+
+  return data;
+}
+
+// Reads the header, accounts and block entries of a segment, and maps the accounts to journal->accounts. Returns the block count.
+static int read_index(Journal* journal, char* data, long size, BlockEntry* index, int* accounts) {
+  SegmentHeader* header = (SegmentHeader*)data;
+  assert(size >= (long)sizeof(SegmentHeader) && !memcmp(header->magic, ARCHIVE_MAGIC, 8) && "invalid archive");
+  assert(header->account_count <= MAX_ACCOUNTS && header->block_count <= MAX_ARCHIVE_BLOCKS);
+
+  char* paths = data + sizeof(SegmentHeader);
+  BlockEntry* stored = (BlockEntry*)(paths + header->account_count * MAX_ACCOUNT_LENGTH);
+  assert((char*)(stored + header->block_count) <= data + size && "invalid archive");
+
+  for (int i = 0; i < header->account_count; i++) {
+    Account* account = get_account(journal, &paths[i * MAX_ACCOUNT_LENGTH]);
+    assert(account && "unknown account in the archive");
+    accounts[i] = account->index;
+  }
+
+  memcpy(index, stored, header->block_count * sizeof(BlockEntry));
+  return header->block_count;
+}
+
+static void map_sums(double* dest, BlockEntry* entry, int* accounts, int account_count) {
+  memset(dest, 0, MAX_ACCOUNTS * sizeof(double));
+  for (int i = 0; i < account_count; i++) dest[accounts[i]] += entry->sums[i];
+}
+
+// Reads the index of the archive, if there is one. Called when the journal is parsed, after the accounts.
+void archive_open(Journal* journal) {
+  Archive* archive = journal->archive;
+  char path[PATH_MAX];
+
+  archive->block_count = 0;
+  memset(&archive->opened, 0, sizeof(archive->opened));
+  memset(&archive->opened_header, 0, sizeof(archive->opened_header));
+  stat(archive_path(journal, path), &archive->opened);
+
+  long size;
+  char* data = read_file(path, &size);
+  if (!data) return;
+
+  trace_begin("read archive index");
+
+  int accounts[MAX_ACCOUNTS];
+  archive->block_count = read_index(journal, data, size, archive->entries, accounts);
+  archive->opened_header = *(SegmentHeader*)data;
+
+  for (int i = 0; i < archive->block_count; i++) {
+    ArchiveBlock* block = &archive->blocks[i];
+    BlockEntry* entry = &archive->entries[i];
+    block->first  = entry->first;
+    block->last   = entry->last;
+    block->count  = entry->count;
+    block->loaded = false;
+    map_sums(block->sums, entry, accounts, ((SegmentHeader*)data)->account_count);
+  }
+
+  free(data);
+  trace_end("read archive index");
+}
+
+// Returns the size of the start of the journal file whose transactions up to the end date are in the archive, which is zero unless the
+// archive names the file as the one a year was archived from and it was not replaced yet. The size is of the file as it was archived,
+// entries appended since are not in the archive.
+static long get_covered(SegmentHeader* header, ino_t journal_inode, long journal_size, Date* end) {
+  if (!header->journal_inode || header->journal_inode != journal_inode || journal_size < header->journal_size) return 0;
+  *end = header->end;
+  return header->journal_size;
+}
+
+long archive_get_covered(Journal* journal, ino_t journal_inode, long journal_size, Date* end) {
+  return get_covered(&journal->archive->opened_header, journal_inode, journal_size, end);
+}
+
+// True if the archive was created, replaced or changed since its index was read.
+bool archive_is_stale(Journal* journal) {
+  struct stat* opened = &journal->archive->opened;
+  struct stat info;
+  char path[PATH_MAX];
+  memset(&info, 0, sizeof(info));
+  stat(archive_path(journal, path), &info);
+
+  return info.st_ino != opened->st_ino || info.st_size != opened->st_size || info.st_mtim.tv_sec != opened->st_mtim.tv_sec ||
+         info.st_mtim.tv_nsec != opened->st_mtim.tv_nsec;
+}
+
+// The journal is loaded from a checkpoint after the archive, which includes the archived transactions.
+void archive_discard(Journal* journal) {
+  journal->archive->block_count = 0;
+}
+
+bool archive_get_end(Journal* journal, Date* date) {
+  Archive* archive = journal->archive;
+  if (!archive->block_count) return false;
+  *date = archive->blocks[archive->block_count - 1].last;
+  return true;
+}
+
+static bool overlaps(ArchiveBlock* block, Date* from, Date* to) {
+  return !date_is_smaller(&block->last, from) && !date_is_bigger(&block->first, to);
+}
+
+static bool is_inside(ArchiveBlock* block, Date* from, Date* to) {
+  return !date_is_smaller(&block->first, from) && !date_is_bigger(&block->last, to);
+}
+
+// True if the balances at the end of the date need some, but not all, transactions of the block.
+static bool splits(ArchiveBlock* block, Date* date) {
+  return !date_is_smaller(date, &block->first) && date_is_smaller(date, &block->last);
+}
+
+// The print and group views need every transaction in the date range. The balance view is summed from the blocks, except the blocks that are
+// only partly in the date range, or split by the -at date.
+static bool needs_block(Command* command, ArchiveBlock* block) {
+  if (block->loaded) return false;
+
+  if (command->type == COMMAND_PRINT || command->type == COMMAND_GROUP)
+    return !command->date_present || overlaps(block, &command->from.date, &command->to.date);
+
+  if (command->type == COMMAND_CHECKPOINT) {
+    Date end = { 31, 12, command->year };
+    return splits(block, &end);
+  }
+
+  if (command->type != COMMAND_BALANCE) return false;
+  if (command->at_present) return splits(block, &command->at);
+
+  return command->date_present && overlaps(block, &command->from.date, &command->to.date) &&
+         !is_inside(block, &command->from.date, &command->to.date);
+}
+
+bool archive_needs_load(Journal* journal, Command* command) {
+  Archive* archive = journal->archive;
+
+  for (int i = 0; i < archive->block_count; i++) {
+    if (needs_block(command, &archive->blocks[i])) return true;
+  }
+  return false;
+}
+
+// Parses the archived transactions the command needs into the journal. Returns true if any were parsed.
+bool archive_load(Journal* journal, Command* command) {
+  if (!archive_needs_load(journal, command)) return false;
+
+  trace_begin("load archive blocks");
+
+  Archive* archive = journal->archive;
+  char path[PATH_MAX];
+  FILE* file = fopen(archive_path(journal, path), "rb");
+  assert(file);
+
+  for (int i = 0; i < archive->block_count; i++) {
+    ArchiveBlock* block = &archive->blocks[i];
+    BlockEntry* entry = &archive->entries[i];
+    if (!needs_block(command, block)) continue;
+
+    u8* data = malloc(entry->size);
+    assert(data);
+    assert(fseek(file, entry->offset, SEEK_SET) == 0);
+    assert(fread(data, 1, entry->size, file) == (size_t)entry->size);
+
+    char* text = arena_push(&journal->arena, entry->raw_size + 1);
+    assert(lz_decompress(data, entry->size, (u8*)text, entry->raw_size) && "invalid archive block");
+    text[entry->raw_size] = 0;
+    free(data);
+
+    journal_add_entries(journal, text);
+    block->loaded = true;
+  }
+
+  fclose(file);
+  trace_end("load archive blocks");
+  return true;
+}
+
+// Stores the blocks that are summed instead of read by the balance view, in date order. Returns the count.
+int get_archive_blocks(Journal* journal, Command* command, ArchiveBlock** result) {
+  Archive* archive = journal->archive;
+  int count = 0;
+  if (command->type != COMMAND_BALANCE || command->at_present) return 0;
+
+  for (int i = 0; i < archive->block_count; i++) {
+    ArchiveBlock* block = &archive->blocks[i];
+    if (block->loaded) continue;
+    if (command->date_present && !is_inside(block, &command->from.date, &command->to.date)) continue;
+
+    if (result) result[count] = block;
+    count++;
+  }
+
+  return count;
+}
+
+// Adds the net amounts of the blocks that are not loaded and end before the date, or on it if inclusive.
+void archive_add_sums_before(Journal* journal, Date* date, bool inclusive, double* sums) {
+  Archive* archive = journal->archive;
+
+  for (int i = 0; i < archive->block_count; i++) {
+    ArchiveBlock* block = &archive->blocks[i];
+    if (block->loaded || date_is_bigger(&block->last, date) || (!inclusive && date_is_equal(&block->last, date))) continue;
+
+    for (int j = 0; j < MAX_ACCOUNTS; j++) sums[j] += block->sums[j];
+  }
+}
+
+static int compare_lines(const void* a, const void* b) {
+  ArchivedLine* x = (ArchivedLine*)a;
+  ArchivedLine* y = (ArchivedLine*)b;
+  if (x->date.year  != y->date.year)  return x->date.year  - y->date.year;
+  if (x->date.month != y->date.month) return x->date.month - y->date.month;
+  return x->order - y->order;
+}
+
+static int compare_blocks(const void* a, const void* b) {
+  NewBlock* x = (NewBlock*)a;
+  NewBlock* y = (NewBlock*)b;
+  if (!date_is_equal(&x->entry.last, &y->entry.last)) return date_is_smaller(&x->entry.last, &y->entry.last) ? -1 : 1;
+  return x->order - y->order;
+}
+
+// Makes a block of the archived lines of one month.
+static void make_block(Journal* journal, NewBlock* block, ArchivedLine* lines, int count) {
+  int raw_size = 0;
+  for (int i = 0; i < count; i++) raw_size += lines[i].length + 1;
+
+  char* text = malloc(raw_size + 1);
+  assert(text);
+
+  BlockEntry* entry = &block->entry;
+  memset(entry, 0, sizeof(BlockEntry));
+  entry->first = entry->last = lines[0].date;
+  entry->count = count;
+  entry->raw_size = 0;
+
+  for (int i = 0; i < count; i++) {
+    ArchivedLine* line = &lines[i];
+    memcpy(&text[entry->raw_size], line->line, line->length);
+    entry->raw_size += line->length;
+    text[entry->raw_size++] = '\n';
+
+    char* cursor = line->line;
+    skip_char(&cursor, '$');
+    Transaction transaction;
+    char* description;
+    int description_length;
+    journal_parse_transaction(journal, &cursor, &transaction, &description, &description_length);
+
+    entry->sums[transaction.from] -= transaction.amount;
+    entry->sums[transaction.to]   += transaction.amount;
+    if (date_is_smaller(&transaction.date, &entry->first)) entry->first = transaction.date;
+    if (date_is_bigger(&transaction.date, &entry->last))   entry->last  = transaction.date;
+  }
+
+  block->data = malloc(lz_bound(entry->raw_size));
+  assert(block->data);
+  entry->size = lz_compress((u8*)text, entry->raw_size, block->data, lz_bound(entry->raw_size));
+  assert(entry->size >= 0);
+
+  free(text);
+}
+
+// The journal file that the segment names was replaced, such that the entries in the file that has its inode now are not skipped.
+static void clear_journal_inode(Journal* journal) {
+  char path[PATH_MAX];
+  int file = open(archive_path(journal, path), O_WRONLY);
+  assert(file >= 0);
+
+  ino_t none = 0;
+  assert(pwrite(file, &none, sizeof(none), offsetof(SegmentHeader, journal_inode)) == sizeof(none));
+  close(file);
+}
+
+// Replaces the file by renaming a complete copy.
+static void write_file(char* path, void* data, long size) {
+  char temporary[PATH_MAX];
+  snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+
+  FILE* file = fopen(temporary, "wb");
+  assert(file);
+  assert(fwrite(data, 1, size, file) == (size_t)size);
+  fclose(file);
+  assert(rename(temporary, path) == 0);
+}
+
+// Moves the transactions up to the end of the year from the journal file into the archive, and returns how many. The journal must be
+// parsed again afterwards. The blocks of the old segment are copied as they are, with the accounts mapped to the current ones.
+int archive_year(Journal* journal, int year) {
+  Date end = { 31, 12, year };
+  char path[PATH_MAX];
+  archive_path(journal, path);
+
+  struct stat info;
+  assert(stat(journal->path, &info) == 0);
+
+  long size;
+  char* content = read_file(journal->path, &size);
+  assert(content);
+
+  // Entries that an interrupted archiving put in the segment already are dropped.
+  long old_size;
+  char* old = read_file(path, &old_size);
+  Date covered_end;
+  long covered = (old && old_size >= (long)sizeof(SegmentHeader)) ? get_covered((SegmentHeader*)old, info.st_ino, size, &covered_end) : 0;
+
+  char* kept = malloc(size + 1);
+  ArchivedLine* archived_lines = malloc(MAX_TRANSACTIONS * sizeof(ArchivedLine));
+  assert(kept && archived_lines);
+  long kept_size = 0;
+  int line_count = 0;
+
+  for (char* cursor = content; *cursor;) {
+    char* line = cursor;
+    char* next = strchr(line, '\n');
+    next = next ? next + 1 : line + strlen(line);
+    cursor = next;
+
+    char* entry = line;
+    while (*entry == ' ' || *entry == '\t') entry++;
+
+    Date date;
+    bool dated = *entry == '$' && sscanf(entry + 1, "%d.%d.%d", &date.day, &date.month, &date.year) == 3;
+
+    if (dated && line - content < covered && !date_is_bigger(&date, &covered_end)) {
+      continue;
+    } else if (dated && !date_is_bigger(&date, &end)) {
+      int length = next - line;
+      while (length && (line[length - 1] == '\n' || line[length - 1] == '\r')) length--;
+      archived_lines[line_count] = (ArchivedLine) { date, line, length, line_count };
+      line_count++;
+    } else {
+      memcpy(&kept[kept_size], line, next - line);
+      kept_size += next - line;
+    }
+  }
+
+  if (!line_count) {
+    // The journal is still replaced if it has entries in the archive, after which they are no longer skipped.
+    if (covered) {
+      write_file(journal->path, kept, kept_size);
+      clear_journal_inode(journal);
+    }
+
+    free(old);
+    free(content);
+    free(kept);
+    free(archived_lines);
+    return 0;
+  }
+
+  trace_begin("archive");
+
+  NewBlock* new_blocks = malloc(MAX_ARCHIVE_BLOCKS * sizeof(NewBlock));
+  assert(new_blocks);
+  int count = 0;
+
+  if (old) {
+    BlockEntry* old_entries = malloc(MAX_ARCHIVE_BLOCKS * sizeof(BlockEntry));
+    assert(old_entries);
+    int accounts[MAX_ACCOUNTS];
+    int old_count = read_index(journal, old, old_size, old_entries, accounts);
+
+    for (int i = 0; i < old_count; i++) {
+      NewBlock* block = &new_blocks[count];
+      block->entry = old_entries[i];
+      block->data  = (u8*)old + old_entries[i].offset;
+      block->copied = true;
+      block->order = count++;
+      map_sums(block->entry.sums, &old_entries[i], accounts, ((SegmentHeader*)old)->account_count);
+    }
+
+    free(old_entries);
+  }
+
+  qsort(archived_lines, line_count, sizeof(ArchivedLine), compare_lines);
+
+  for (int start = 0, i = 1; i <= line_count; i++) {
+    Date* first = &archived_lines[start].date;
+    if (i < line_count && archived_lines[i].date.year == first->year && archived_lines[i].date.month == first->month) continue;
+
+    assert(count < MAX_ARCHIVE_BLOCKS);
+    NewBlock* block = &new_blocks[count];
+    make_block(journal, block, &archived_lines[start], i - start);
+    block->copied = false;
+    block->order = count++;
+    start = i;
+  }
+
+  qsort(new_blocks, count, sizeof(NewBlock), compare_blocks);
+
+  // The segment is written with the accounts of the journal, so the sums are stored by journal account.
+  long index_size = sizeof(SegmentHeader) + journal->account_count * MAX_ACCOUNT_LENGTH + count * sizeof(BlockEntry);
+  long segment_size = index_size;
+  for (int i = 0; i < count; i++) segment_size += new_blocks[i].entry.size;
+
+  char* segment = calloc(segment_size, 1);
+  assert(segment);
+
+  SegmentHeader* header = (SegmentHeader*)segment;
+  memcpy(header->magic, ARCHIVE_MAGIC, 8);
+  header->account_count = journal->account_count;
+  header->block_count = count;
+  header->end = end;
+  header->journal_inode = info.st_ino;
+  header->journal_size = size;
+
+  char* paths = segment + sizeof(SegmentHeader);
+  for (int i = 0; i < journal->account_count; i++) strcpy(&paths[i * MAX_ACCOUNT_LENGTH], journal->accounts[i].path);
+
+  BlockEntry* index = (BlockEntry*)(paths + journal->account_count * MAX_ACCOUNT_LENGTH);
+  long offset = index_size;
+
+  for (int i = 0; i < count; i++) {
+    NewBlock* block = &new_blocks[i];
+    index[i] = block->entry;
+    index[i].offset = offset;
+    memcpy(&segment[offset], block->data, block->entry.size);
+    offset += block->entry.size;
+    if (!block->copied) free(block->data);
+  }
+
+  // Both files are replaced by renaming a complete copy. The archive is replaced first, the journal still has the transactions until then,
+  // and they are skipped while the archive names the journal file.
+  write_file(path, segment, segment_size);
+  write_file(journal->path, kept, kept_size);
+  clear_journal_inode(journal);
+
+  free(segment);
+  free(old);
+  free(content);
+  free(kept);
+  free(archived_lines);
+  free(new_blocks);
+
+  trace_end("archive");
+  return line_count;
+}
@@ -0,0 +1,29 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "command.h"
+#include <sys/types.h>
+
+#define MAX_ARCHIVE_BLOCKS 1024
+
+typedef struct {
+  Date first;
+  Date last;
+  int  count;
+  double sums[MAX_ACCOUNTS]; // Net amount of the block per account in journal.accounts.
+  bool loaded;               // The transactions of the block are in the journal.
+} ArchiveBlock;
+
+Archive* archive_create();
+void archive_open(Journal* journal);
+void archive_discard(Journal* journal);
+bool archive_is_stale(Journal* journal);
+bool archive_get_end(Journal* journal, Date* date);
+long archive_get_covered(Journal* journal, ino_t journal_inode, long journal_size, Date* end);
+bool archive_needs_load(Journal* journal, Command* command);
+bool archive_load(Journal* journal, Command* command);
+int  get_archive_blocks(Journal* journal, Command* command, ArchiveBlock** blocks);
+void archive_add_sums_before(Journal* journal, Date* date, bool inclusive, double* sums);
+int  archive_year(Journal* journal, int year);
+
+#endif
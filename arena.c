@@ -0,0 +1,74 @@
+#include "arena.h"
+#include "basic.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// Bump allocator made of a list of blocks. Resetting rewinds to the first block and keeps every block for reuse.
+
+static ArenaBlock* new_block(size_t size, ArenaBlock* next) {
+  size_t block_size = ARENA_BLOCK_SIZE;
+  while (block_size < size) block_size *= 2;
+
+  ArenaBlock* block = malloc(sizeof(ArenaBlock) + block_size);
+  assert(block);
+
+  block->next = next;
+  block->size = block_size;
+  block->used = 0;
+  return block;
+}
+
+void* arena_push(Arena* arena, size_t size) {
+  size = (size + 15) & ~(size_t)15;
+
+  if (!arena->current) {
+    arena->first = arena->current = new_block(size, 0);
+  }
+
+  while (arena->current->used + size > arena->current->size) {
+    ArenaBlock* next = arena->current->next;
+
+    // Blocks too small for the request are replaced, such that the arena does not grow when the requests do.
+    if (next && next->size < size) {
+      ArenaBlock* replacement = new_block(size, next->next);
+      free(next);
+      next = replacement;
+      arena->current->next = next;
+    }
+
+    if (!next) {
+      next = new_block(size, 0);
+      arena->current->next = next;
+    }
+
+    next->used = 0;
+    arena->current = next;
+  }
+
+  void* pointer = arena->current->data + arena->current->used;
+  arena->current->used += size;
+  return pointer;
+}
+
+char* arena_push_string(Arena* arena, char* data, int size) {
+  char* string = arena_push(arena, size + 1);
+  memcpy(string, data, size);
+  string[size] = 0;
+  return string;
+}
+
+void arena_reset(Arena* arena) {
+  arena->current = arena->first;
+  if (arena->current) arena->current->used = 0;
+}
+
+void arena_free(Arena* arena) {
+  while (arena->first) {
+    ArenaBlock* next = arena->first->next;
+    free(arena->first);
+    arena->first = next;
+  }
+
+  arena->current = 0;
+}
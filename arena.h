@@ -0,0 +1,27 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+typedef struct ArenaBlock ArenaBlock;
+
+struct ArenaBlock {
+  ArenaBlock* next;
+  size_t size;
+  size_t used;
+  char data[];
+};
+
+typedef struct {
+  ArenaBlock* first;
+  ArenaBlock* current;
+} Arena;
+
+void* arena_push(Arena* arena, size_t size);
+char* arena_push_string(Arena* arena, char* data, int size);
+void  arena_reset(Arena* arena);
+void  arena_free(Arena* arena);
+
+#endif
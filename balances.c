@@ -0,0 +1,58 @@
+#include "balances.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// Balances of every account over the date order, as a Fenwick tree of account sum vectors. Node i covers the positions from
+// i - lowest_bit(i) up to but not including i, so the balances before any position are the sum of at most log2(n) nodes. Transactions
+// inserted into the date order only change the nodes after the position they are inserted at.
+
+struct Balances {
+  double tree[MAX_TRANSACTIONS + 1][MAX_ACCOUNTS];
+  int size;
+};
+
+Balances* balances_create() {
+  Balances* balances = calloc(1, sizeof(Balances));
+  assert(balances);
+  return balances;
+}
+
+static int lowest_bit(int i) {
+  return i & -i;
+}
+
+static void add_sums(double* sums, double* other) {
+  for (int i = 0; i < MAX_ACCOUNTS; i++) sums[i] += other[i];
+}
+
+static void set_node(double* node, Transaction* transaction) {
+  memset(node, 0, MAX_ACCOUNTS * sizeof(double));
+  node[transaction->from] -= transaction->amount;
+  node[transaction->to]   += transaction->amount;
+}
+
+// Sets the nodes after the position from the order, in linear time: every node adds itself to the next node that covers it. The nodes up
+// to the position are kept, and the ones of them that are covered by a later node are the nodes that sum the balances before it.
+void balances_update(Balances* balances, Transaction** order, int position, int count) {
+  double (*tree)[MAX_ACCOUNTS] = balances->tree;
+  balances->size = count;
+
+  for (int i = position + 1; i <= count; i++) set_node(tree[i], order[i - 1]);
+
+  for (int i = position; i > 0; i -= lowest_bit(i)) {
+    int parent = i + lowest_bit(i);
+    if (parent <= count) add_sums(tree[parent], tree[i]);
+  }
+
+  for (int i = position + 1; i <= count; i++) {
+    int parent = i + lowest_bit(i);
+    if (parent <= count) add_sums(tree[parent], tree[i]);
+  }
+}
+
+// Sums of every transaction before the position in the date order, starting from the opening balances of the journal.
+void get_balances_before(Journal* journal, int position, double* sums) {
+  memcpy(sums, journal->opening_sums, MAX_ACCOUNTS * sizeof(double));
+  for (int i = position; i > 0; i -= lowest_bit(i)) add_sums(sums, journal->balances->tree[i]);
+}
@@ -0,0 +1,10 @@
+#ifndef BALANCES_H
+#define BALANCES_H
+
+#include "journal.h"
+
+Balances* balances_create();
+void balances_update(Balances* balances, Transaction** order, int position, int count);
+void get_balances_before(Journal* journal, int position, double* sums);
+
+#endif
@@ -0,0 +1,163 @@
+#include "bitmap.h"
+#include "journal.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+// Selection bitmaps over journal->raw_transactions, or over journal->postings for the unified view, cached per predicate for the session.
+// The predicates are the operands of and, or and not, keyed by their exact filter text. A filter is assembled from the cached bitmaps
+// word by word. Entries are dropped when the journal is parsed again, and extended with the appended transactions otherwise. Queries on
+// separate threads share the cache, an entry is only used under its mutex and copied out.
+
+#define MAX_CACHED_BITMAPS 64
+#define MAX_KEY_LENGTH     256
+
+typedef struct {
+  char key[MAX_KEY_LENGTH];
+  int  generation;
+  bool postings;
+  int  count; // Rows covered by the bitmap.
+  u64  last_used;
+  u64  bits[BITMAP_WORDS];
+} CachedBitmap;
+
+struct BitmapCache {
+  CachedBitmap entries[MAX_CACHED_BITMAPS];
+  u64 use_counter;
+  pthread_mutex_t mutex;
+};
+
+BitmapCache* bitmap_create() {
+  BitmapCache* cache = calloc(1, sizeof(BitmapCache));
+  assert(cache);
+  assert(pthread_mutex_init(&cache->mutex, 0) == 0);
+  return cache;
+}
+
+static bool is_predicate(Filter* filter) {
+  if (filter->type == FILTER_UNARY) return false;
+  if (filter->type == FILTER_BINARY && (filter->binary.type == BINARY_AND || filter->binary.type == BINARY_OR)) return false;
+  return true;
+}
+
+// The key ignores the parenthesis around the predicate itself.
+static bool get_key(Journal* journal, Filter* filter, char* key) {
+  bool parenthesized = filter->parenthesized;
+  filter->parenthesized = false;
+
+  key[0] = 0;
+  format_filter(journal, key, MAX_KEY_LENGTH, filter, true);
+
+  filter->parenthesized = parenthesized;
+  return strlen(key) < MAX_KEY_LENGTH - 1;
+}
+
+static int get_row_count(Journal* journal, bool postings) {
+  return postings ? 2 * journal->raw_transaction_count : journal->raw_transaction_count;
+}
+
+static CachedBitmap* find(Journal* journal, char* key, bool postings) {
+  for (int i = 0; i < MAX_CACHED_BITMAPS; i++) {
+    CachedBitmap* entry = &journal->bitmaps->entries[i];
+    if (entry->generation == journal->generation && entry->last_used && entry->postings == postings && !strcmp(entry->key, key)) return entry;
+  }
+  return 0;
+}
+
+static CachedBitmap* get_free_entry(Journal* journal) {
+  CachedBitmap* entries = journal->bitmaps->entries;
+  CachedBitmap* oldest = &entries[0];
+
+  for (int i = 0; i < MAX_CACHED_BITMAPS; i++) {
+    CachedBitmap* entry = &entries[i];
+    if (entry->generation != journal->generation || !entry->last_used) return entry;
+    if (entry->last_used < oldest->last_used) oldest = entry;
+  }
+
+  return oldest;
+}
+
+static void evaluate(Journal* journal, Filter* filter, u64* bits, int start, int end, bool postings) {
+  for (int i = start; i < end; i++) {
+    u64 bit = 1ull << (i & 63);
+    double result = postings ? apply_filter_posting(filter, &journal->postings[i]) : apply_filter(filter, &journal->raw_transactions[i]);
+    if (result != 0) {
+      bits[i >> 6] |= bit;
+    } else {
+      bits[i >> 6] &= ~bit;
+    }
+  }
+}
+
+static void get_predicate_bitmap(Journal* journal, Filter* filter, u64* bits, bool postings) {
+  char key[MAX_KEY_LENGTH];
+  int count = get_row_count(journal, postings);
+
+  if (!get_key(journal, filter, key)) {
+    evaluate(journal, filter, bits, 0, count, postings);
+    return;
+  }
+
+  BitmapCache* cache = journal->bitmaps;
+  pthread_mutex_lock(&cache->mutex);
+  CachedBitmap* entry = find(journal, key, postings);
+
+  if (!entry) {
+    entry = get_free_entry(journal);
+    strcpy(entry->key, key);
+    entry->generation = journal->generation;
+    entry->postings = postings;
+    entry->count = 0;
+    memset(entry->bits, 0, sizeof(entry->bits));
+  }
+
+  // Appended transactions are evaluated and added to the cached bitmap.
+  if (entry->count < count) {
+    trace_begin("evaluate predicate");
+    evaluate(journal, filter, entry->bits, entry->count, count, postings);
+    entry->count = count;
+    trace_end("evaluate predicate");
+  }
+
+  entry->last_used = ++cache->use_counter;
+  memcpy(bits, entry->bits, sizeof(entry->bits));
+  pthread_mutex_unlock(&cache->mutex);
+}
+
+// True if every predicate of the filter has a current bitmap, such that the filter costs only word operations.
+bool bitmap_is_cached(Journal* journal, Filter* filter, bool postings) {
+  if (filter->type == FILTER_UNARY) return bitmap_is_cached(journal, filter->unary.filter, postings);
+  if (!is_predicate(filter))
+    return bitmap_is_cached(journal, filter->binary.left, postings) && bitmap_is_cached(journal, filter->binary.right, postings);
+
+  char key[MAX_KEY_LENGTH];
+  if (!get_key(journal, filter, key)) return false;
+
+  pthread_mutex_lock(&journal->bitmaps->mutex);
+  bool cached = find(journal, key, postings) != 0;
+  pthread_mutex_unlock(&journal->bitmaps->mutex);
+  return cached;
+}
+
+void get_filter_bitmap(Journal* journal, Filter* filter, u64* bits, bool postings) {
+  int words = (get_row_count(journal, postings) + 63) / 64;
+
+  if (filter->type == FILTER_UNARY) {
+    get_filter_bitmap(journal, filter->unary.filter, bits, postings);
+    for (int i = 0; i < words; i++) bits[i] = ~bits[i];
+  } else if (is_predicate(filter)) {
+    get_predicate_bitmap(journal, filter, bits, postings);
+  } else {
+    u64 right[BITMAP_WORDS];
+    get_filter_bitmap(journal, filter->binary.left, bits, postings);
+    get_filter_bitmap(journal, filter->binary.right, right, postings);
+
+    if (filter->binary.type == BINARY_AND) {
+      for (int i = 0; i < words; i++) bits[i] &= right[i];
+    } else {
+      for (int i = 0; i < words; i++) bits[i] |= right[i];
+    }
+  }
+}
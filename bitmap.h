@@ -0,0 +1,14 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include "command.h"
+
+BitmapCache* bitmap_create();
+bool bitmap_is_cached(Journal* journal, Filter* filter, bool postings);
+void get_filter_bitmap(Journal* journal, Filter* filter, u64* bits, bool postings);
+
+static inline bool bitmap_test(u64* bits, int index) {
+  return (bits[index >> 6] >> (index & 63)) & 1;
+}
+
+#endif
@@ -0,0 +1,345 @@
+#include "cash.h"
+#include "journal.h"
+#include "parser.h"
+#include "output.h"
+#include "stats.h"
+#include "description.h"
+#include "archive.h"
+#include "planner.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <assert.h>
+
+// A journal handle owns the parsed journal with its indices and caches. Every call of cash_execute runs in a query context of its own,
+// taken from the idle ones of the handle. A compiled query has its own query context, and keeps its command text to parse it again when
+// it runs, since a parsed filter lives in the filter arena of the context until the next parse. Results are copied out of the engine,
+// such that they stay valid while other queries run. Queries are executed quiet, such that the engine prints nothing.
+//
+// Commands that only read the journal run at the same time under the lock of the handle for reading. Changing the journal, by parsing
+// what was appended, loading archived transactions or updating the indices, and the commands that write to the journal file take the
+// lock for writing.
+
+#define MAX_IDLE_QUERIES 16
+
+struct CashJournal {
+  Journal* journal;
+  pthread_rwlock_t lock;
+
+  pthread_mutex_t idle_mutex;
+  Query* idle[MAX_IDLE_QUERIES];
+  int idle_count;
+};
+
+struct CashQuery {
+  CashJournal* journal;
+  Query* query;
+  char text[INPUT_SIZE];
+  Posting postings[2 * MAX_TRANSACTIONS];
+};
+
+struct CashResult {
+  int row_count;
+  CashRow* rows;
+  char* descriptions; // The zero terminated descriptions of the rows, one after another.
+
+  int period_count;
+  CashPeriod* periods;
+  double* sums;
+};
+
+CashJournal* cash_open(const char* path) {
+  Journal* journal = journal_open(path);
+  if (!journal) return 0;
+
+  CashJournal* handle = calloc(1, sizeof(CashJournal));
+  assert(handle);
+  handle->journal = journal;
+  assert(pthread_rwlock_init(&handle->lock, 0) == 0);
+  assert(pthread_mutex_init(&handle->idle_mutex, 0) == 0);
+  return handle;
+}
+
+void cash_close(CashJournal* handle) {
+  for (int i = 0; i < handle->idle_count; i++) query_free(handle->idle[i]);
+  pthread_rwlock_destroy(&handle->lock);
+  pthread_mutex_destroy(&handle->idle_mutex);
+  journal_free(handle->journal);
+  free(handle);
+}
+
+static Query* take_query(CashJournal* handle) {
+  pthread_mutex_lock(&handle->idle_mutex);
+  Query* query = handle->idle_count ? handle->idle[--handle->idle_count] : 0;
+  pthread_mutex_unlock(&handle->idle_mutex);
+  return query ? query : query_create(handle->journal);
+}
+
+static void put_query(CashJournal* handle, Query* query) {
+  pthread_mutex_lock(&handle->idle_mutex);
+  if (handle->idle_count < MAX_IDLE_QUERIES) {
+    handle->idle[handle->idle_count++] = query;
+    query = 0;
+  }
+  pthread_mutex_unlock(&handle->idle_mutex);
+  query_free(query);
+}
+
+// Parses what other programs appended to the journal file.
+static void catch_up(CashJournal* handle) {
+  pthread_rwlock_rdlock(&handle->lock);
+  bool stale = journal_is_stale(handle->journal);
+  pthread_rwlock_unlock(&handle->lock);
+  if (!stale) return;
+
+  pthread_rwlock_wrlock(&handle->lock);
+  if (journal_is_stale(handle->journal)) journal_reload(handle->journal);
+  pthread_rwlock_unlock(&handle->lock);
+}
+
+static bool changes_journal(Command* command) {
+  return command->type == COMMAND_ADD || command->type == COMMAND_CHECKPOINT || command->type == COMMAND_ARCHIVE;
+}
+
+// True if the command can run under the lock for reading: it does not change the journal, which has the archived transactions it needs
+// and current indices.
+static bool is_ready(Journal* journal, Command* command) {
+  return !changes_journal(command) && !archive_needs_load(journal, command) && planner_is_current(journal);
+}
+
+static char* parse(Query* query, char* text, bool is_query) {
+  Command command;
+  if (is_query) return parse_query(query, text, &command);
+
+  query->error_message = 0;
+  if (parse_command_line(query, text, PARSE_REQUEST)) return 0;
+  return query->error_message ? query->error_message : "invalid command";
+}
+
+// Parses the command into query->options, and returns with the lock taken that the command runs under. When the journal lacks what the
+// command needs, it is added under the lock for writing, and the command is parsed again, since the filter may match descriptions that
+// were added. Returns the error, without the lock, if the command does not parse.
+static char* lock_command(CashJournal* handle, Query* query, char* text, bool is_query) {
+  while (true) {
+    pthread_rwlock_rdlock(&handle->lock);
+    char* error = parse(query, text, is_query);
+    if (error || is_ready(handle->journal, &query->options)) {
+      if (error) pthread_rwlock_unlock(&handle->lock);
+      return error;
+    }
+    pthread_rwlock_unlock(&handle->lock);
+
+    pthread_rwlock_wrlock(&handle->lock);
+
+    if (changes_journal(&query->options)) {
+      error = parse(query, text, is_query);
+      if (error) pthread_rwlock_unlock(&handle->lock);
+      return error;
+    }
+
+    archive_load(handle->journal, &query->options);
+    planner_update_indices(handle->journal);
+    pthread_rwlock_unlock(&handle->lock);
+  }
+}
+
+static bool print_error(char* message) {
+  print("   \033[31mError:\033[0m %s\n", message);
+  flush();
+  return false;
+}
+
+bool cash_execute(CashJournal* handle, const char* command, int width) {
+  char text[INPUT_SIZE];
+  if (strlen(command) >= INPUT_SIZE - 1) return print_error("the command is too long");
+  strcpy(text, command);
+
+  catch_up(handle);
+  Query* query = take_query(handle);
+  char* error = lock_command(handle, query, text, false);
+
+  if (error) {
+    put_query(handle, query);
+    return print_error(error);
+  }
+
+  set_size(width, 0);
+  execute_command(query, &query->options);
+  pthread_rwlock_unlock(&handle->lock);
+  put_query(handle, query);
+
+  QueryStats stats;
+  if (stats_take_query(&stats)) stats_publish(&stats);
+
+  print("\n");
+  flush();
+  return true;
+}
+
+int cash_account_count(CashJournal* handle) {
+  pthread_rwlock_rdlock(&handle->lock);
+  int count = handle->journal->account_count;
+  pthread_rwlock_unlock(&handle->lock);
+  return count;
+}
+
+const char* cash_account_path(CashJournal* handle, int account) {
+  pthread_rwlock_rdlock(&handle->lock);
+  assert(account >= 0 && account < handle->journal->account_count);
+  const char* path = handle->journal->accounts[account].path;
+  pthread_rwlock_unlock(&handle->lock);
+  return path;
+}
+
+bool cash_account_is_category(CashJournal* handle, int account) {
+  pthread_rwlock_rdlock(&handle->lock);
+  assert(account >= 0 && account < handle->journal->account_count);
+  bool is_category = handle->journal->accounts[account].is_category;
+  pthread_rwlock_unlock(&handle->lock);
+  return is_category;
+}
+
+CashQuery* cash_compile(CashJournal* handle, const char* command, const char** error) {
+  if (strlen(command) >= INPUT_SIZE - 1) {
+    *error = "the command is too long";
+    return 0;
+  }
+
+  CashQuery* query = malloc(sizeof(CashQuery));
+  assert(query);
+  query->journal = handle;
+  query->query = query_create(handle->journal);
+  strcpy(query->text, command);
+
+  Command parsed;
+  pthread_rwlock_rdlock(&handle->lock);
+  *error = parse_query(query->query, query->text, &parsed);
+  pthread_rwlock_unlock(&handle->lock);
+
+  if (*error) {
+    cash_query_free(query);
+    return 0;
+  }
+
+  return query;
+}
+
+void cash_query_free(CashQuery* query) {
+  query_free(query->query);
+  free(query);
+}
+
+static void copy_date(CashDate* dest, Date* date) {
+  *dest = (CashDate) { date->day, date->month, date->year };
+}
+
+static void copy_rows(CashQuery* query, CashResult* result, int count) {
+  Journal* journal = query->journal->journal;
+  Posting* postings = query->postings;
+  int size = 0;
+
+  for (int i = 0; i < count; i++) {
+    int description = postings[i].transaction->description;
+    if (description) size += get_description(journal, description)->length;
+    size++;
+  }
+
+  result->rows = malloc(count * sizeof(CashRow) + 1);
+  result->descriptions = malloc(size + 1);
+  assert(result->rows && result->descriptions);
+
+  char* cursor = result->descriptions;
+
+  for (int i = 0; i < count; i++) {
+    Posting* posting = &postings[i];
+    Transaction* trans = posting->transaction;
+    CashRow* row = &result->rows[i];
+
+    copy_date(&row->date, &trans->date);
+    row->account      = posting->account;
+    row->counterparty = posting->counterparty;
+    row->amount       = posting->amount;
+    row->running      = query->query->from_sums[trans - journal->raw_transactions];
+    row->reference    = trans->reference;
+    row->description  = cursor;
+
+    if (trans->description) {
+      Description* description = get_description(journal, trans->description);
+      memcpy(cursor, description->string, description->length);
+      cursor += description->length;
+    }
+
+    *cursor++ = 0;
+  }
+
+  result->row_count = count;
+}
+
+static void copy_periods(CashQuery* query, CashResult* result, Period* periods, int count) {
+  int account_count = query->journal->journal->account_count;
+  result->periods = malloc(count * sizeof(CashPeriod) + 1);
+  result->sums = malloc(count * account_count * sizeof(double) + 1);
+  assert(result->periods && result->sums);
+
+  for (int i = 0; i < count; i++) {
+    double* sums = &result->sums[i * account_count];
+    memcpy(sums, periods[i].sum, account_count * sizeof(double));
+    copy_date(&result->periods[i].date, &periods[i].date);
+    result->periods[i].sums = sums;
+  }
+
+  result->period_count = count;
+}
+
+// Returns 0 if the query is no longer valid, like when an account it refers to was removed from the journal.
+CashResult* cash_run(CashQuery* query) {
+  CashJournal* handle = query->journal;
+  catch_up(handle);
+  if (lock_command(handle, query->query, query->text, true)) return 0;
+
+  Command command = query->query->options;
+  command.quiet = true;
+  execute_command(query->query, &command);
+
+  CashResult* result = calloc(1, sizeof(CashResult));
+  assert(result);
+
+  if (command.type == COMMAND_PRINT) {
+    copy_rows(query, result, get_query_rows(query->query, query->postings));
+  } else {
+    Period* periods;
+    int count = get_query_periods(query->query, &periods);
+    copy_periods(query, result, periods, count);
+  }
+
+  pthread_rwlock_unlock(&handle->lock);
+  return result;
+}
+
+void cash_result_free(CashResult* result) {
+  free(result->rows);
+  free(result->descriptions);
+  free(result->periods);
+  free(result->sums);
+  free(result);
+}
+
+int cash_row_count(CashResult* result) {
+  return result->row_count;
+}
+
+CashRow* cash_get_row(CashResult* result, int index) {
+  assert(index >= 0 && index < result->row_count);
+  return &result->rows[index];
+}
+
+int cash_period_count(CashResult* result) {
+  return result->period_count;
+}
+
+CashPeriod* cash_get_period(CashResult* result, int index) {
+  assert(index >= 0 && index < result->period_count);
+  return &result->periods[index];
+}
@@ -0,0 +1,65 @@
+#ifndef CASH_H
+#define CASH_H
+
+#include <stdbool.h>
+
+// Interface of libcash, for programs that query a journal without the terminal interface. Queries are print and balance commands, with
+// the same options and filters as in a session. Every opened journal has its own state, so several journals can be open at once. The
+// functions on a journal can be called from several threads at once, queries that only read it then run at the same time. A compiled
+// query is used by one thread at a time.
+//
+// The cash program is built on it: the server and commands given as arguments open the journal here and execute their commands with
+// cash_execute. The session uses the engine below it directly.
+
+typedef struct CashJournal CashJournal;
+typedef struct CashQuery   CashQuery;
+typedef struct CashResult  CashResult;
+
+typedef struct {
+  int day;
+  int month;
+  int year;
+} CashDate;
+
+// A printed line of a print query.
+typedef struct {
+  CashDate date;
+  int account;      // Index of the account the row is seen from, the source unless the query is unified.
+  int counterparty; // Index of the other account.
+  double amount;    // Negative for the source side in the unified view.
+  double running;   // Running sum of the source account, with -r.
+  int reference;    // -1 without a reference.
+  const char* description;
+} CashRow;
+
+// A column of a balance query.
+typedef struct {
+  CashDate date;      // Last date of the period.
+  const double* sums; // By account index, categories include their subaccounts.
+} CashPeriod;
+
+// Returns 0 if the journal can not be read. Closing releases the memory and the mapping of the journal.
+CashJournal* cash_open(const char* path);
+void         cash_close(CashJournal* journal);
+int          cash_account_count(CashJournal* journal);
+const char*  cash_account_path(CashJournal* journal, int account);
+bool         cash_account_is_category(CashJournal* journal, int account);
+
+// Executes a command like a session does, and prints its output for a screen of the width. An add command is given the transaction on
+// the line: add <date> <from> <to> <amount> ['description']. The output goes to standard output, or to the capture of the calling
+// thread. Returns false, with the error printed, if the command does not parse.
+bool cash_execute(CashJournal* journal, const char* command, int width);
+
+// Returns 0 with the error if the command is not a valid query.
+CashQuery* cash_compile(CashJournal* journal, const char* command, const char** error);
+void       cash_query_free(CashQuery* query);
+
+// Runs the query on the journal, after reading what was appended to it since it was last read. The result stays valid until it is freed.
+CashResult* cash_run(CashQuery* query);
+void        cash_result_free(CashResult* result);
+int         cash_row_count(CashResult* result);
+CashRow*    cash_get_row(CashResult* result, int index);
+int         cash_period_count(CashResult* result);
+CashPeriod* cash_get_period(CashResult* result, int index);
+
+#endif
@@ -1,30 +1,41 @@
 #include "command.h"
 #include "basic.h"
-#include "terminal.h"
+#include "output.h"
 #include "journal.h"
 #include "date.h"
+#include "stats.h"
+#include "pool.h"
+#include "description.h"
+#include "planner.h"
+#include "bitmap.h"
+#include "results.h"
+#include "archive.h"
+#include "group.h"
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
 
-#define MAX_PERIODS        24
 #define LEFT_INDENTATION   3
 #define INTEGRAL_WIDTH     8
 #define NUMBER_WIDTH       (INTEGRAL_WIDTH + 3)
 #define REF_WIDTH          3
+#define MIN_CHUNK_SIZE     4096 // About 100 us of filtering, such that handing a chunk to a worker is a small part of its cost.
 
-typedef struct {
-  Date date;
-  double sum[MAX_ACCOUNTS];
-} Period;
-
-static Transaction* transactions[MAX_TRANSACTIONS];
-static int transaction_count;
-
-static Period periods[MAX_PERIODS];
-static int period_count;
+Query* query_create(Journal* journal) {
+  Query* query = calloc(1, sizeof(Query));
+  assert(query);
+  query->journal = journal;
+  return query;
+}
 
-static double running_sums[MAX_ACCOUNTS];
-static double initial_sums[MAX_ACCOUNTS];
+void query_free(Query* query) {
+  if (!query) return;
+  release_result(query);
+  arena_free(&query->filter_data);
+  free(query->groups);
+  free(query->result);
+  free(query);
+}
 
 static void start_line() {
   set_x_cursor(LEFT_INDENTATION);
@@ -34,10 +45,6 @@ static void set_this_cursor(int x) {
   set_x_cursor(LEFT_INDENTATION + x);
 }
 
-static Transaction* sort_date_get_first(Transaction* a, Transaction* b) {
-  return date_is_smaller(&a->date, &b->date) ? a : b;
-}
-
 static Transaction* sort_from_get_first(Transaction* a, Transaction* b) {
   return (a->from < b->from) ? a : b;
 }
@@ -50,10 +57,10 @@ static Transaction* sort_amount_get_first(Transaction* a, Transaction* b) {
   return (a->amount < b->amount) ? a : b;
 }
 
-static int get_max_account_path_length(int indentation) {
+static int get_max_account_path_length(Journal* journal, int indentation) {
   int max = 0;
-  for (int i = 1; i < journal.account_count; i++) {
-    Account* account = &journal.accounts[i];
+  for (int i = 1; i < journal->account_count; i++) {
+    Account* account = &journal->accounts[i];
     int current = indentation * (account->level - 1) + account->path_length;
     if (current > max) max = current;
   }
@@ -61,10 +68,10 @@ static int get_max_account_path_length(int indentation) {
   return max;
 }
 
-static int get_max_account_name_length(int indentation) {
+static int get_max_account_name_length(Journal* journal, int indentation) {
   int max = 0;
-  for (int i = 1; i < journal.account_count; i++) {
-    Account* account = &journal.accounts[i];
+  for (int i = 1; i < journal->account_count; i++) {
+    Account* account = &journal->accounts[i];
     int current = indentation * (account->level - 1) + account->name_length;
     if (current > max) max = current;
   }
@@ -76,17 +83,17 @@ static int month_to_quarter(int month) {
   return 1 + (month - 1) / 4;
 }
 
-static bool is_new_period(Command* options, Transaction* prev, Transaction* current) {
+static bool is_new_period(Command* options, Date* prev, Date* current) {
   if (prev == 0)
     return false;
 
-  if (options->monthly && prev->date.month != current->date.month)
+  if (options->monthly && prev->month != current->month)
     return true;
 
-  if (options->quarterly && month_to_quarter(prev->date.month) != month_to_quarter(current->date.month))
+  if (options->quarterly && month_to_quarter(prev->month) != month_to_quarter(current->month))
     return true;
 
-  if (options->yearly && prev->date.year != current->date.year)
+  if (options->yearly && prev->year != current->year)
     return true;
 
   return false;
@@ -107,65 +114,71 @@ static double compute_category_sums(Account* account, double* data) {
   return sum;
 }
 
-static void compute_budget_sum(Account* account, double* y, double* m) {
-  double y_sum = 0;
-  double m_sum = 0;
+static void save_period_info(Query* query, Date* last_date) {
+  Period* period = &query->periods[query->period_count++];
+  compute_category_sums(query->journal->root_account, query->initial_sums);
+  memcpy(period->sum, query->initial_sums, sizeof(query->initial_sums));
+  period->date = *last_date;
+}
 
-  if (!account->is_category) {
-    *y = account->yearly_budget;
-    *m = account->monthly_budget;
-    return;
-  }
+// Adds a transaction or an archived block to the periods, dated by its last transaction. Returns false when the periods are full.
+static bool add_to_periods(Query* query, Command* command, Date** prev_date, Date* date, int from, int to, double amount,
+                           double* block_sums) {
+  if (is_new_period(command, *prev_date, date)) {
+    save_period_info(query, *prev_date);
 
-  Account* child = account->childs;
-  while (child) {
-    double y, m;
-    compute_budget_sum(child, &y, &m);
-    y_sum += y;
-    m_sum += m;
+    if (!command->running)
+      memset(query->initial_sums, 0, sizeof(query->initial_sums));
 
-    child = child->next;
+    if (query->period_count == MAX_PERIODS)
+      return false;
   }
 
-  account->yearly_budget = y_sum;
-  account->monthly_budget = m_sum;
-}
+  if (block_sums) {
+    for (int i = 0; i < MAX_ACCOUNTS; i++) query->initial_sums[i] += block_sums[i];
+  } else {
+    query->initial_sums[to]   += amount;
+    query->initial_sums[from] -= amount;
+  }
 
-static void save_period_info(Transaction* last_transaction) {
-  Period* period = &periods[period_count++];
-  compute_category_sums(journal.root_account, initial_sums);
-  memcpy(period->sum, initial_sums, sizeof(initial_sums));
-  period->date = last_transaction->date;
+  *prev_date = date;
+  return true;
 }
 
-static void get_periods(Command* command) {
-  period_count = 0;
+// The archived blocks that are not loaded are merged into the transactions by date, each adds its sums at once.
+static void get_periods(Query* query, Command* command) {
+  query->period_count = 0;
 
-  if (!command->running)
-    memset(initial_sums, 0, sizeof(initial_sums));
-
-  Transaction* prev_trans = 0;
-
-  for (int i = 0; i < transaction_count; i++) {
-    Transaction* trans = transactions[i];
+  // Without a date range the balances start from the checkpoint the journal was loaded from, which sums the earlier periods.
+  if (!command->running) {
+    bool periodic = command->monthly || command->quarterly || command->yearly;
+    if (!command->date_present && !periodic) {
+      memcpy(query->initial_sums, query->journal->opening_sums, sizeof(query->initial_sums));
+    } else {
+      memset(query->initial_sums, 0, sizeof(query->initial_sums));
+    }
+  }
 
-    if (is_new_period(command, prev_trans, trans)) {
-      save_period_info(prev_trans);
+  ArchiveBlock* archive_blocks[MAX_ARCHIVE_BLOCKS];
+  int block_count = get_archive_blocks(query->journal, command, archive_blocks);
+  int block = 0;
+  Date* prev_date = 0;
 
-      if (!command->running)
-        memset(initial_sums, 0, sizeof(initial_sums));
+  for (int i = 0; i < query->transaction_count; i++) {
+    Transaction* trans = query->transactions[i];
 
-      if (period_count == MAX_PERIODS)
-        return;
+    for (; block < block_count && date_is_smaller(&archive_blocks[block]->last, &trans->date); block++) {
+      if (!add_to_periods(query, command, &prev_date, &archive_blocks[block]->last, 0, 0, 0, archive_blocks[block]->sums)) return;
     }
 
-    initial_sums[trans->to]   += trans->amount;
-    initial_sums[trans->from] -= trans->amount;
+    if (!add_to_periods(query, command, &prev_date, &trans->date, trans->from, trans->to, trans->amount, 0)) return;
+  }
 
-    prev_trans = trans;
+  for (; block < block_count; block++) {
+    if (!add_to_periods(query, command, &prev_date, &archive_blocks[block]->last, 0, 0, 0, archive_blocks[block]->sums)) return;
   }
 
-  save_period_info(prev_trans);
+  save_period_info(query, prev_date);
 }
 
 void print_chars(int count, char c) {
@@ -201,7 +214,9 @@ void print_number_in_field(bool print_zero, double number, int width, bool posit
   }
 }
 
-void print_balance(Command* command) {
+void print_balance(Query* query, Command* command) {
+  Journal* journal = query->journal;
+
   if (!command->flat)
     command->is_short = true;
 
@@ -214,23 +229,21 @@ void print_balance(Command* command) {
   if (command->no_grid)
     command->print_zeros = true;
 
-  get_periods(command);
-  compute_budget_sum(journal.root_account, 0, 0);
-
   int width, height;
   get_size(&width, &height);
 
   int indentation      = command->flat ? 0 : 4;
-  int name_width       = command->is_short ? get_max_account_name_length(indentation) : get_max_account_path_length(indentation);
+  int name_width       = command->is_short ? get_max_account_name_length(journal, indentation)
+                                           : get_max_account_path_length(journal, indentation);
   int name_field_width = name_width + 1;
   int number_width     = 0;
   int number_field_width;
   int column_count;
 
   // Compute the maximum number width.
-  for (int i = 0; i < period_count; i++) {
-    for (int j = 0; j < journal.account_count; j++) {
-      int width = get_digit_count(periods[i].sum[j]);
+  for (int i = 0; i < query->period_count; i++) {
+    for (int j = 0; j < journal->account_count; j++) {
+      int width = get_digit_count(query->periods[i].sum[j]);
       if (width > number_width) {
         number_width = width;
       }
@@ -250,7 +263,7 @@ void print_balance(Command* command) {
 
   number_width = max(number_width + 3, date_width);
   number_field_width = number_width + 1;
-  column_count = min(period_count, (width - LEFT_INDENTATION - name_field_width) / number_field_width);
+  column_count = min(query->period_count, (width - LEFT_INDENTATION - name_field_width) / number_field_width);
 
   // Print dates.
   start_line();
@@ -259,7 +272,7 @@ void print_balance(Command* command) {
   for (int i = 0; i < column_count; i++) {
     print_chars(diff(NUMBER_WIDTH, date_width), ' ');
 
-    Date* date = &periods[i].date;
+    Date* date = &query->periods[i].date;
     if (command->monthly) {
       print("%s.", month_names[date->month - 1]);
     } else if (command->quarterly) {
@@ -273,16 +286,14 @@ void print_balance(Command* command) {
 
   print("\n");
 
-  bool print_enable[journal.account_count];
+  bool print_enable[journal->account_count];
   memset(print_enable, 0, sizeof(print_enable));
 
-  for (int i = 0; i < journal.account_count; i++) {
-    Account* account = &journal.accounts[i];
+  for (int i = 0; i < journal->account_count; i++) {
+    Account* account = &journal->accounts[i];
 
-    if (command->budget && account->monthly_budget == 0 && account->yearly_budget == 0) {
-      debug("Skipping %s\n", account->path);
+    if (command->budget && account->monthly_budget == 0 && account->yearly_budget == 0)
       continue;
-    }
 
     if (command->filter && !apply_filter_account(command->filter, account))
       continue;
@@ -290,18 +301,17 @@ void print_balance(Command* command) {
 
     while (account) {
       print_enable[account->index] = true;
-      debug("Marking %d  to print\n", account->index);
       account = account->parent;
     }
   }
 
   // Print account name and balance columns.
-  for (int i = 1; i < journal.account_count; i++) {
-    Account* account = &journal.accounts[i];
+  for (int i = 1; i < journal->account_count; i++) {
+    Account* account = &journal->accounts[i];
     if (print_enable[i] == false) continue;
 
     if (account->is_category) {
-      if (account->parent == journal.root_account && !command->no_grid) {
+      if (account->parent == journal->root_account && !command->no_grid) {
         print_balance_splitter(name_width, number_width, column_count, false);
       }
       if (command->flat) continue;
@@ -325,8 +335,8 @@ void print_balance(Command* command) {
       print("%c", command->no_grid ? ' ' : '|');
       if (command->percent) {
         assert(account->parent); // Iterate from 1.
-        double parent_sum = periods[j].sum[account->parent->index];
-        double this_sum   = periods[j].sum[i];
+        double parent_sum = query->periods[j].sum[account->parent->index];
+        double this_sum   = query->periods[j].sum[i];
         double percent = (double)(100.0 * (this_sum / parent_sum));
 
         if (parent_sum == 0 || percent == 0) {
@@ -335,7 +345,7 @@ void print_balance(Command* command) {
           print("%*.2lf%%", NUMBER_WIDTH - 1, percent);
         }
       } else {
-        double tmp = periods[j].sum[i];
+        double tmp = query->periods[j].sum[i];
 
         if (command->budget) {
           if (command->yearly) {
@@ -396,41 +406,45 @@ static void print_transaction_splitter(Command* command, int name_width) {
   print("-------------\n");
 }
 
-void print_transaction(Command* command, Transaction* t, double* sums) {
+// Prints the transaction as seen from the posting's account. The running column is the running sum of the transaction's source account.
+void print_transaction(Query* query, Command* command, Posting* posting, double* sums) {
+  Journal* journal = query->journal;
+  Transaction* t = posting->transaction;
+
   start_line();
   print("%02d.%s.%4d", t->date.day, month_names[t->date.month - 1], t->date.year);
 
-  int name_width = command->is_short ? get_max_account_name_length(0) : get_max_account_path_length(0);
+  int name_width = command->is_short ? get_max_account_name_length(journal, 0) : get_max_account_path_length(journal, 0);
   int padding;
 
-  int from = t->from;
-  int to   = t->to;
+  int from = posting->account;
+  int to   = posting->counterparty;
   char splitter = command->no_grid ? ' ' : '|';
 
   print(" %c ", splitter);
-  print("%s", command->is_short ? journal.accounts[from].name : journal.accounts[from].path);
-  padding = name_width - (command->is_short ? journal.accounts[from].name_length : journal.accounts[from].path_length);
+  print("%s", command->is_short ? journal->accounts[from].name : journal->accounts[from].path);
+  padding = name_width - (command->is_short ? journal->accounts[from].name_length : journal->accounts[from].path_length);
   assert(padding >= 0);
   while (padding--) print(" ");
 
   print(" %c ", splitter);
-  print("%s", command->is_short ? journal.accounts[to].name : journal.accounts[to].path);
-  padding = name_width - (command->is_short ? journal.accounts[to].name_length : journal.accounts[to].path_length);
+  print("%s", command->is_short ? journal->accounts[to].name : journal->accounts[to].path);
+  padding = name_width - (command->is_short ? journal->accounts[to].name_length : journal->accounts[to].path_length);
   assert(padding >= 0);
   while (padding--) print(" ");
 
 
   print(" %c ", splitter);
-  print_number_in_field(command->print_zeros, t->amount, NUMBER_WIDTH, false);
+  print_number_in_field(command->print_zeros, posting->amount, NUMBER_WIDTH, false);
 
   if (command->running) {
     print(" %c ", splitter);
-    print_number_in_field(command->print_zeros, t->from_sum, NUMBER_WIDTH, false);
+    print_number_in_field(command->print_zeros, query->from_sums[t - journal->raw_transactions], NUMBER_WIDTH, false);
   }
 
   if (command->sum) {
     print(" %c ", splitter);
-    print_number_in_field(command->print_zeros, sums[t->from], NUMBER_WIDTH, false);
+    print_number_in_field(command->print_zeros, sums[from], NUMBER_WIDTH, false);
   }
 
   if (command->print_ref) {
@@ -444,19 +458,18 @@ void print_transaction(Command* command, Transaction* t, double* sums) {
 
   print(" %c ", splitter);
   if (t->description) {
-    print("%s", t->description);
+    Description* description = get_description(journal, t->description);
+    print("%.*s", description->length, description->string);
   }
 
   print("\n");
 }
 
-static void print_transactions(Command* command) {
+static void print_transactions(Query* query, Command* command) {
+  Journal* journal = query->journal;
   print("\n");
 
-  if (command->running || command->sum)
-    command->unify = true;
-
-  int name_width = command->is_short ? get_max_account_name_length(0) : get_max_account_path_length(0);
+  int name_width = command->is_short ? get_max_account_name_length(journal, 0) : get_max_account_path_length(journal, 0);
 
   double sums[MAX_ACCOUNTS];
   memset(sums, 0, sizeof(sums));
@@ -464,10 +477,12 @@ static void print_transactions(Command* command) {
   int count = 0;
 
   Transaction* prev_trans = 0;
-  for (int i = 0; i < transaction_count; i++) {
-    Transaction* trans = transactions[i];
+  for (int i = 0; i < query->transaction_count; i++) {
+    if (query->cancelled) return;
 
-    if (is_new_period(command, prev_trans, trans)) {
+    Transaction* trans = query->transactions[i];
+
+    if (is_new_period(command, prev_trans ? &prev_trans->date : 0, &trans->date)) {
       if (command->no_grid)
         print("\n");
       else 
@@ -480,32 +495,368 @@ static void print_transactions(Command* command) {
     sums[trans->to]   += trans->amount;
 
     if (command->unify) {
-      trans->amount *= -1;
+      int index = trans - journal->raw_transactions;
+      Posting* postings = &journal->postings[2 * index];
 
-      if (trans->unify_print_from)
-        print_transaction(command, transactions[i], sums);
+      if (query->printed_sides[index] & 1)
+        print_transaction(query, command, &postings[0], sums);
 
-      trans->amount *= -1;
+      if (query->printed_sides[index] & 2)
+        print_transaction(query, command, &postings[1], sums);
+    } else {
+      Posting posting = { trans, trans->from, trans->to, trans->amount };
+      print_transaction(query, command, &posting, sums);
+    }
 
-      int tmp = trans->from;
-      trans->from = trans->to;
-      trans->to = tmp;
+    prev_trans = trans;
+  }
+}
 
-      if (trans->unify_print_to)
-        print_transaction(command, transactions[i], sums);
+static bool keep_transaction(Query* query, Command* command, Transaction* trans) {
+  Journal* journal = query->journal;
+  bool date_keep_transaction = !command->date_present || (!date_is_smaller(&trans->date, &command->from.date) && !date_is_bigger(&trans->date, &command->to.date));
+  bool filter_keep;
 
-      tmp = trans->from;
-      trans->from = trans->to;
-      trans->to = tmp;
-    } else {
-      print_transaction(command, transactions[i], sums);
+  if (command->unify) {
+    // The filter sees each posting, the transaction is kept if either of them passes.
+    int index = trans - journal->raw_transactions;
+    Posting* postings = &journal->postings[2 * index];
+    int sides = 0;
+
+    for (int i = 0; i < 2; i++) {
+      bool keep;
+
+      if (command->filter == 0) {
+        keep = true;
+      } else if (query->use_filter_bits) {
+        keep = bitmap_test(query->filter_bits, 2 * index + i);
+      } else {
+        keep = apply_filter_posting(command->filter, &postings[i]);
+      }
+
+      if (keep) sides |= 1 << i;
     }
 
-    prev_trans = trans;
+    query->printed_sides[index] = sides;
+    filter_keep = sides != 0;
+  } else if (query->use_filter_bits) {
+    filter_keep = bitmap_test(query->filter_bits, trans - journal->raw_transactions);
+  } else {
+    filter_keep = command->type == COMMAND_BALANCE || command->filter == 0 || apply_filter(command->filter, trans);
+  }
+
+  return filter_keep && date_keep_transaction;
+}
+
+// Filters one chunk of the date ordered transactions. Running sums are relative to the start of the chunk.
+static void filter_chunk(int index, void* data) {
+  Query* query = data;
+  Command* command = query->command;
+  Journal* journal = query->journal;
+  Chunk* chunk = &query->chunks[index];
+  double* sums = chunk->sums;
+
+  memset(sums, 0, sizeof(chunk->sums));
+  chunk->kept = 0;
+  chunk->any_kept = false;
+
+  for (int i = chunk->start; i < chunk->end && !query->cancelled; i++) {
+    Transaction* trans = query->transactions[i];
+    bool keep = keep_transaction(query, command, trans);
+
+    if (keep && !chunk->any_kept) {
+      memcpy(chunk->first_sums, sums, sizeof(chunk->sums));
+      chunk->any_kept = true;
+    }
+
+    sums[trans->from] -= trans->amount;
+    sums[trans->to]   += trans->amount;
+
+    int raw = trans - journal->raw_transactions;
+    query->from_sums[raw] = sums[trans->from];
+    query->to_sums[raw]   = sums[trans->to];
+
+    if (keep)
+      query->kept_transactions[chunk->start + chunk->kept++] = trans;
   }
 }
 
-void execute_command(Command* command) {
+static void offset_chunk_sums(int index, void* data) {
+  Query* query = data;
+  Chunk* chunk = &query->chunks[index];
+
+  for (int i = chunk->start; i < chunk->end; i++) {
+    Transaction* trans = query->transactions[i];
+    int raw = trans - query->journal->raw_transactions;
+    query->from_sums[raw] += chunk->start_sums[trans->from];
+    query->to_sums[raw]   += chunk->start_sums[trans->to];
+  }
+}
+
+static void filter_all(Query* query, Command* command, int count) {
+  Chunk* chunks = query->chunks;
+  double* running_sums = query->running_sums;
+
+  // Filter date ordered chunks in parallel, then fix up the running sums with a prefix pass over the chunk totals.
+  int chunk_count = query->chunk_count = limit(count / MIN_CHUNK_SIZE, 1, min(MAX_CHUNKS, 4 * pool_thread_count()));
+
+  for (int i = 0; i < chunk_count; i++) {
+    chunks[i].start = (int)((s64)count * i / chunk_count);
+    chunks[i].end   = (int)((s64)count * (i + 1) / chunk_count);
+  }
+
+  query->command = command;
+  pool_run(filter_chunk, chunk_count, query);
+
+  memcpy(running_sums, query->base_sums, sizeof(query->running_sums));
+  memcpy(query->initial_sums, query->base_sums, sizeof(query->initial_sums));
+
+  int kept = 0;
+
+  for (int i = 0; i < chunk_count; i++) {
+    Chunk* chunk = &chunks[i];
+
+    if (chunk->any_kept && kept == 0) {
+      for (int j = 0; j < MAX_ACCOUNTS; j++) query->initial_sums[j] = running_sums[j] + chunk->first_sums[j];
+    }
+
+    memcpy(chunk->start_sums, running_sums, sizeof(query->running_sums));
+    for (int j = 0; j < MAX_ACCOUNTS; j++) running_sums[j] += chunk->sums[j];
+
+    kept += chunk->kept;
+  }
+
+  // Only the running column shows the sums of the rows.
+  if (command->running) pool_run(offset_chunk_sums, chunk_count, query);
+
+  kept = 0;
+
+  for (int i = 0; i < chunk_count; i++) {
+    memcpy(&query->transactions[kept], &query->kept_transactions[chunks[i].start], chunks[i].kept * sizeof(Transaction*));
+    kept += chunks[i].kept;
+  }
+
+  query->transaction_count = kept;
+}
+
+// Filters the date ordered rows from the start, or from the end for -tail, until enough transactions are kept. Returns the rows scanned.
+static int filter_limited(Query* query, Command* command, int count) {
+  Transaction** transactions = query->transactions;
+  Transaction** kept = query->kept_transactions;
+  int wanted = command->tail ? command->tail : command->limit;
+  int kept_count = 0;
+  int scanned = 0;
+
+  if (command->tail) {
+    for (int i = count - 1; i >= 0 && kept_count < wanted; i--, scanned++) {
+      if (keep_transaction(query, command, transactions[i])) kept[kept_count++] = transactions[i];
+    }
+
+    for (int i = 0; i < kept_count; i++) transactions[i] = kept[kept_count - 1 - i];
+  } else {
+    for (int i = 0; i < count && kept_count < wanted; i++, scanned++) {
+      if (keep_transaction(query, command, transactions[i])) transactions[kept_count++] = transactions[i];
+    }
+  }
+
+  query->transaction_count = kept_count;
+  return scanned;
+}
+
+static double get_sort_key(Command* command, Transaction* trans) {
+  switch (command->sort) {
+    case SORT_FROM: return trans->from;
+    case SORT_TO:   return trans->to;
+    default:        return trans->amount;
+  }
+}
+
+// The order of merge sorting the date ordered rows, which puts ties in reverse order when ascending and keeps them when descending.
+static bool sorts_before(Query* query, Command* command, int a, int b) {
+  double x = get_sort_key(command, query->transactions[a]);
+  double y = get_sort_key(command, query->transactions[b]);
+  if (x != y) return command->sort_reverse ? x > y : x < y;
+  return command->sort_reverse ? a < b : a > b;
+}
+
+static bool heap_before(Query* query, Command* command, int a, int b, bool from_end) {
+  return from_end ? sorts_before(query, command, b, a) : sorts_before(query, command, a, b);
+}
+
+static void sift_down(Query* query, Command* command, int size, int index, bool from_end) {
+  int* heap = query->heap;
+
+  while (true) {
+    int last  = index;
+    int left  = 2 * index + 1;
+    int right = left + 1;
+
+    if (left  < size && heap_before(query, command, heap[last], heap[left],  from_end)) last = left;
+    if (right < size && heap_before(query, command, heap[last], heap[right], from_end)) last = right;
+    if (last == index) return;
+
+    int tmp = heap[index];
+    heap[index] = heap[last];
+    heap[last] = tmp;
+    index = last;
+  }
+}
+
+static void sift_up(Query* query, Command* command, int index, bool from_end) {
+  int* heap = query->heap;
+
+  while (index > 0) {
+    int parent = (index - 1) / 2;
+    if (!heap_before(query, command, heap[parent], heap[index], from_end)) return;
+
+    int tmp = heap[index];
+    heap[index] = heap[parent];
+    heap[parent] = tmp;
+    index = parent;
+  }
+}
+
+// Selects the first transactions in sort order, or the last for -tail, with a bounded heap whose root is the transaction to drop next.
+// The selection is then sorted by taking the roots off the heap, which gives the same order as sorting every kept transaction.
+static void select_transactions(Query* query, Command* command) {
+  int* heap = query->heap;
+  bool from_end = command->tail > 0;
+  int wanted = min(from_end ? command->tail : command->limit, query->transaction_count);
+  int size = 0;
+
+  for (int i = 0; i < query->transaction_count; i++) {
+    if (size < wanted) {
+      heap[size] = i;
+      sift_up(query, command, size++, from_end);
+    } else if (heap_before(query, command, i, heap[0], from_end)) {
+      heap[0] = i;
+      sift_down(query, command, size, 0, from_end);
+    }
+  }
+
+  for (int end = size - 1; end > 0; end--) {
+    int tmp = heap[0];
+    heap[0] = heap[end];
+    heap[end] = tmp;
+    sift_down(query, command, end, 0, from_end);
+  }
+
+  for (int i = 0; i < size; i++) query->kept_transactions[i] = query->transactions[heap[from_end ? size - 1 - i : i]];
+  memcpy(query->transactions, query->kept_transactions, size * sizeof(Transaction*));
+  query->transaction_count = size;
+}
+
+// Keeps the last -tail transactions, then the first -limit of those.
+static void slice_transactions(Query* query, Command* command) {
+  int count = query->transaction_count;
+
+  if (command->tail && count > command->tail) {
+    memmove(query->transactions, &query->transactions[count - command->tail], command->tail * sizeof(Transaction*));
+    count = command->tail;
+  }
+
+  if (command->limit && count > command->limit) {
+    count = command->limit;
+  }
+
+  query->transaction_count = count;
+}
+
+// Transactions up to the opening date are not loaded when the journal starts from a checkpoint, only their balances are. Warns if
+// the date needs them, which is the case for a range starting at or before the opening date, or balances before it.
+static void warn_before_opening(Journal* journal, Date* date, bool range) {
+  Date* opening = &journal->opening_date;
+  if (!journal->opening_present || date_is_bigger(date, opening) || (!range && date_is_equal(date, opening))) return;
+
+  start_line();
+  print("\033[33mTransactions up to %02d.%02d.%d are only loaded as checkpoint balances", opening->day, opening->month, opening->year);
+  format_off();
+  print("\n");
+}
+
+// Appends the balances at the end of the year to the journal, such that later sessions can load from it. The balances before the
+// opening date are not known when the journal is loaded from a checkpoint.
+static void execute_checkpoint(Query* query, Command* command) {
+  Journal* journal = query->journal;
+  Date date = { 31, 12, command->year };
+  start_line();
+
+  if (journal->opening_present && date_is_smaller(&date, &journal->opening_date)) {
+    print("\033[31mThe journal is loaded from a later checkpoint");
+    format_off();
+    return;
+  }
+
+  // The balances include the transactions that other sessions appended before the lock. If that parsed the journal again, the archived
+  // transactions are loaded again.
+  int file = journal_lock(journal);
+  archive_load(journal, command);
+  double sums[MAX_ACCOUNTS];
+  get_balances_at(journal, &date, sums);
+  journal_append_checkpoint(journal, file, &date, sums);
+  journal_unlock(file);
+
+  print("Checkpoint written for 31.12.%d", command->year);
+}
+
+// Moves the transactions up to the end of the year into the archive, and parses the remaining journal. The old journal file stays
+// locked until it is replaced, such that appends by other sessions wait for the new one.
+static void execute_archive(Query* query, Command* command) {
+  int file = journal_lock(query->journal);
+  int count = archive_year(query->journal, command->year);
+  journal_unlock(file);
+  if (count) journal_parse(query->journal);
+
+  start_line();
+  print("Archived %d transactions up to 31.12.%d", count, command->year);
+}
+
+// Appends the transaction of an add request to the journal, which parses it with what other sessions appended before it.
+static void execute_add(Query* query, Command* command) {
+  Journal* journal = query->journal;
+  Transaction* t = &command->transaction;
+  journal_append_transaction(journal, t, command->description);
+
+  start_line();
+  print("Added %.2f from %s to %s on %02d.%02d.%d", t->amount, journal->accounts[t->from].path, journal->accounts[t->to].path, t->date.day,
+        t->date.month, t->date.year);
+}
+
+// The balances at a date are read from the balance index, without reading any transactions.
+static void execute_balance_at(Query* query, Command* command) {
+  stats_begin(STAGE_QUERY);
+
+  if (!command->quiet) warn_before_opening(query->journal, &command->at, false);
+
+  stats_begin(STAGE_PERIODS);
+  command->monthly = command->quarterly = command->yearly = false;
+
+  Period* period = &query->periods[0];
+  get_balances_at(query->journal, &command->at, period->sum);
+  compute_category_sums(query->journal->root_account, period->sum);
+  period->date = command->at;
+  query->period_count = 1;
+  stats_end(STAGE_PERIODS);
+
+  stats_begin(STAGE_LAYOUT);
+  if (!command->quiet) print_balance(query, command);
+  stats_end(STAGE_LAYOUT);
+
+  stats_begin(STAGE_FLUSH);
+  flush();
+  stats_end(STAGE_FLUSH);
+
+  stats_end(STAGE_QUERY);
+
+  if (command->stats && !command->quiet) {
+    print("\n");
+    print_query_stats();
+  }
+}
+
+static void execute(Query* query, Command* command) {
+  Journal* journal = query->journal;
+
   // Handle commands that does not need transactions.
   if (command->type == COMMAND_CLEAR) {
     clear_all();
@@ -513,77 +864,134 @@ void execute_command(Command* command) {
     return;
   }
 
-  // If the filter is changed, print the modified filter.
-  if (command->filter && command->filter_modified) {
-    start_line();
-    print("Using filter: ");
-    print_filter(command->filter);
-    print("\n");
+  if (command->type == COMMAND_STATS) {
+    print_stats();
+    return;
   }
 
-  // Store pointers to all transactions and sort the list by date.
-  for (int i = 0; i < journal.raw_transaction_count; i++)
-    transactions[i] = &journal.raw_transactions[i];
+  if (command->type == COMMAND_ARCHIVE) {
+    execute_archive(query, command);
+    return;
+  }
+
+  if (command->type == COMMAND_ADD) {
+    execute_add(query, command);
+    return;
+  }
 
-  journal_sort_transactions(transactions, journal.raw_transaction_count, sort_date_get_first, false);
+  // Archived transactions are only parsed when the command needs them. Their descriptions are added after the filter was parsed.
+  if (archive_load(journal, command)) update_description_matches(query, command->filter);
 
-  memset(running_sums, 0, sizeof(running_sums));
-  memset(initial_sums, 0, sizeof(initial_sums));
+  if (command->type == COMMAND_CHECKPOINT) {
+    execute_checkpoint(query, command);
+    return;
+  }
 
-  transaction_count = 0;
+  if (command->type == COMMAND_BALANCE && command->at_present) {
+    execute_balance_at(query, command);
+    return;
+  }
 
-  for (int i = 0; i < journal.raw_transaction_count; i++) {
-    Transaction* trans = transactions[i];
+  stats_begin(STAGE_QUERY);
+  query->transaction_count = 0;
+  query->period_count = 0;
+  query->rows_unified = false;
 
-    bool date_keep_transaction = !command->date_present || (!date_is_smaller(&trans->date, &command->from.date) && !date_is_bigger(&trans->date, &command->to.date));
-    bool filter_keep;
+  // Running totals and period sums are shown per account, which needs the unified view. Set before filtering, since the filter decides
+  // which sides of the transactions are printed.
+  if (command->type == COMMAND_PRINT && (command->running || command->sum))
+    command->unify = true;
 
-    if (command->unify) {
-      trans->unify_print_from = false;
-      trans->unify_print_to = false;
+  query->rows_unified = command->unify;
 
-      trans->amount *= -1;
-      
-      if (command->filter == 0 || apply_filter(command->filter, trans))
-        trans->unify_print_from = true;
-      
-      trans->amount *= -1;
+  // If the filter is changed, print the modified filter.
+  if (command->filter && command->filter_modified && !command->quiet) {
+    start_line();
+    print("Using filter: ");
+    print_filter(journal, command->filter);
+    print("\n");
+  }
 
-      int tmp = trans->from;
-      trans->from = trans->to;
-      trans->to = tmp;
+  if (command->date_present && !command->quiet) warn_before_opening(journal, &command->from.date, true);
 
-      if (command->filter == 0 || apply_filter(command->filter, trans))
-        trans->unify_print_to = true;
+  // The date order is only sorted again when the journal has changed.
+  stats_begin(STAGE_SORT);
+  planner_update_indices(journal);
+  stats_end(STAGE_SORT);
 
-      tmp = trans->from;
-      trans->from = trans->to;
-      trans->to = tmp;
+  // Read the candidate rows in date order, from the full date order, a date slice or the posting lists of an account.
+  stats_begin(STAGE_PLAN);
+  Plan plan = plan_query(query, command);
+  int count = plan_get_rows(query, &plan, query->transactions, query->printed_sides);
+  stats_end(STAGE_PLAN);
 
-      filter_keep = trans->unify_print_from || trans->unify_print_to;
-    } else {
-      filter_keep = command->type == COMMAND_BALANCE || command->filter == 0 || apply_filter(command->filter, trans);
-    }
+  stats_begin(STAGE_FILTER);
 
-    bool keep = filter_keep && date_keep_transaction;
+  bool limited = command->type == COMMAND_PRINT && (command->limit || command->tail);
+  int scanned = count;
 
-    if (keep && transaction_count == 0)
-      memcpy(initial_sums, running_sums, sizeof(running_sums));
+  // The filter is assembled from cached predicate bitmaps when they exist, or when the plan reads most of the journal anyway, which
+  // caches them for the next queries. In unified mode the bitmaps are over the postings.
+  query->use_filter_bits = false;
 
-    running_sums[trans->from] -= trans->amount;
-    running_sums[trans->to]   += trans->amount;
+  if (command->filter && command->type != COMMAND_BALANCE) {
+    if (bitmap_is_cached(journal, command->filter, command->unify) || 4 * plan.rows_read >= journal->raw_transaction_count) {
+      get_filter_bitmap(journal, command->filter, query->filter_bits, command->unify);
+      query->use_filter_bits = true;
+    }
+  }
 
-    trans->from_sum = running_sums[trans->from];
-    trans->to_sum   = running_sums[trans->to];
+  // A cached result is already filtered. In date order the kept transactions are final, so a limited scan stops as soon as it has enough,
+  // but then the result is not complete enough to be cached. Running sums need every transaction.
+  if (plan.type == PLAN_CACHED_RESULT) {
+    query->transaction_count = count;
+    scanned = 0;
+  } else if (limited && command->sort == SORT_DATE && !command->running) {
+    scanned = filter_limited(query, command, count);
+  } else {
+    plan_get_start_sums(journal, &plan, query->base_sums);
+    if (command->date_present) archive_add_sums_before(journal, &command->from.date, false, query->base_sums);
+    filter_all(query, command, count);
+    if (!plan.amount_ordered && !query->cancelled)
+      store_result(query, command, query->transactions, query->transaction_count, query->printed_sides);
+  }
 
-    if (keep)
-      transactions[transaction_count++] = trans;
+  stats_end(STAGE_FILTER);
+
+  // A cancelled command prints nothing more, its output is discarded.
+  if (query->cancelled) {
+    stats_end(STAGE_QUERY);
+    stats_cancel_query();
+    return;
   }
+  stats_count_rows(scanned, query->transaction_count);
+
+  // Nothing is loaded after the checkpoint yet, the balances are the ones of the checkpoint.
+  if (!query->transaction_count && command->type == COMMAND_BALANCE && journal->opening_present && !command->date_present) {
+    stats_end(STAGE_QUERY);
+    command->at = journal->opening_date;
+    execute_balance_at(query, command);
+    return;
+  }
+
+  // The balance view can be summed from archived blocks alone.
+  if (!query->transaction_count && !(command->type == COMMAND_BALANCE && get_archive_blocks(journal, command, 0))) {
+    stats_end(STAGE_QUERY);
+    if (command->quiet) return;
 
-  if (!transaction_count) {
     start_line();
     print("\033[31mNo transactions");
     format_off();
+
+    if (command->explain) {
+      print("\n\n");
+      print_plan(journal, &plan, query->transaction_count);
+    }
+
+    if (command->stats) {
+      print(command->explain ? "\n" : "\n\n");
+      print_query_stats();
+    }
     return;
   }
 
@@ -591,19 +999,110 @@ void execute_command(Command* command) {
   if (command->type == COMMAND_BALANCE)
     command->sort = SORT_DATE;
 
-  if (command->sort == SORT_FROM) {
-    journal_sort_transactions(transactions, transaction_count, sort_from_get_first, command->sort_reverse);
+  stats_begin(STAGE_ORDER);
+  Transaction** rows = query->transactions;
+
+  if (command->type == COMMAND_GROUP) {
+    // The groups are ordered instead of the rows.
+  } else if (limited && command->sort != SORT_DATE && !plan.amount_ordered) {
+    select_transactions(query, command);
+  } else if (command->sort == SORT_FROM) {
+    journal_sort_transactions(rows, query->transaction_count, query->sort_buffer, sort_from_get_first, command->sort_reverse);
   } else if (command->sort == SORT_TO) {
-    journal_sort_transactions(transactions, transaction_count, sort_to_get_first, command->sort_reverse);
+    journal_sort_transactions(rows, query->transaction_count, query->sort_buffer, sort_to_get_first, command->sort_reverse);
+  } else if (command->sort == SORT_AMOUNT && plan.amount_ordered) {
+    // Read from the amount order, descending is the exact reverse.
+    if (command->sort_reverse) {
+      for (int i = 0, j = query->transaction_count - 1; i < j; i++, j--) {
+        Transaction* tmp = rows[i];
+        rows[i] = rows[j];
+        rows[j] = tmp;
+      }
+    }
   } else if (command->sort == SORT_AMOUNT) {
-    journal_sort_transactions(transactions, transaction_count, sort_amount_get_first, command->sort_reverse);
+    journal_sort_transactions(rows, query->transaction_count, query->sort_buffer, sort_amount_get_first, command->sort_reverse);
+  }
+
+  if (limited) slice_transactions(query, command);
+
+  stats_end(STAGE_ORDER);
+
+  if (command->type == COMMAND_BALANCE) {
+    stats_begin(STAGE_PERIODS);
+    if (!get_result_periods(query, query->periods, &query->period_count, query->initial_sums)) {
+      get_periods(query, command);
+      store_result_periods(query, query->periods, query->period_count, query->initial_sums);
+    }
+    stats_end(STAGE_PERIODS);
   }
 
-  if (command->type == COMMAND_PRINT) {
-    print_transactions(command);
+  stats_begin(STAGE_LAYOUT);
+
+  if (command->quiet) {
+    // Read by the caller.
+  } else if (command->type == COMMAND_PRINT) {
+    print_transactions(query, command);
   } else if (command->type == COMMAND_BALANCE) {
-    print_balance(command);
+    print_balance(query, command);
+  } else if (command->type == COMMAND_GROUP) {
+    print_groups(query, command);
   }
 
+  stats_end(STAGE_LAYOUT);
+
+  stats_begin(STAGE_FLUSH);
   flush();
+  stats_end(STAGE_FLUSH);
+
+  stats_end(STAGE_QUERY);
+
+  if (query->cancelled) {
+    stats_cancel_query();
+    return;
+  }
+
+  if (command->quiet) return;
+
+  if (command->explain) {
+    print("\n");
+    print_plan(journal, &plan, query->transaction_count);
+  }
+
+  if (command->stats) {
+    print("\n");
+    print_query_stats();
+  }
+}
+
+// The cached results the command read or stored can be replaced by other queries once it is done.
+void execute_command(Query* query, Command* command) {
+  execute(query, command);
+  release_result(query);
+}
+
+// Stores the rows of the last print query in printed order, as the postings that are printed: the printed sides of each transaction in
+// the unified view, otherwise each transaction from its source. Returns the count, at most 2 * MAX_TRANSACTIONS.
+int get_query_rows(Query* query, Posting* rows) {
+  Journal* journal = query->journal;
+  int count = 0;
+
+  for (int i = 0; i < query->transaction_count; i++) {
+    Transaction* trans = query->transactions[i];
+
+    if (query->rows_unified) {
+      int index = trans - journal->raw_transactions;
+      if (query->printed_sides[index] & 1) rows[count++] = journal->postings[2 * index];
+      if (query->printed_sides[index] & 2) rows[count++] = journal->postings[2 * index + 1];
+    } else {
+      rows[count++] = (Posting) { trans, trans->from, trans->to, trans->amount };
+    }
+  }
+
+  return count;
+}
+
+// The periods of the last balance query, with the sums of the categories included.
+int get_query_periods(Query* query, Period** result) {
+  *result = query->periods;
+  return query->period_count;
 }
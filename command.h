@@ -1,11 +1,122 @@
 #ifndef COMMAND_H
 #define COMMAND_H
 
-#include "command_line.h"
+#include "journal.h"
+#include "date.h"
+#include "arena.h"
+#include "pool.h"
+#include <stdbool.h>
+#include <signal.h>
+
+typedef struct Filter Filter;
+
+enum {
+  PRIMARY_FROM,
+  PRIMARY_TO,
+  PRIMARY_ACCOUNT,
+  PRIMARY_DESCRIPTION,
+  PRIMARY_DESCRIPTION_REGEX,
+  PRIMARY_AMOUNT,
+  PRIMARY_NUMBER,
+  PRIMARY_DAY,
+  PRIMARY_WEEKDAY, // @Constructed and not parsed.
+  PRIMARY_MONTH,
+  PRIMARY_YEAR,
+  PRIMARY_REF_PRESENT,
+  PRIMARY_REF_SEARCH,
+  PRIMARY_DAY_NUMBER,
+};
+
+enum {
+  UNARY_NOT,
+};
+
+enum {
+  BINARY_NONE,
+  BINARY_EQUAL,
+  BINARY_LESS_THAN,
+  BINARY_GREATER_THAN,
+  BINARY_LESS_EQUAL,
+  BINARY_GREATER_EQUAL,
+  BINARY_NOT_EQUAL,
+  BINARY_OR,
+  BINARY_AND,
+  BINARY_MULTIPLY,
+  BINARY_DIVIDE,
+  BINARY_PLUS,
+  BINARY_MINUS,
+};
+
+enum {
+  FILTER_PRIMARY,
+  FILTER_UNARY,
+  FILTER_BINARY,
+};
+
+enum {
+  COMMAND_PRINT,
+  COMMAND_ADD,
+  COMMAND_BALANCE,
+  COMMAND_CLEAR,
+  COMMAND_STATS,
+  COMMAND_CHECKPOINT,
+  COMMAND_ARCHIVE,
+  COMMAND_GROUP,
+};
+
+enum {
+  SORT_DATE,
+  SORT_AMOUNT,
+  SORT_FROM,
+  SORT_TO,
+  SORT_COUNT, // The rest order the groups of the group command.
+  SORT_SUM,
+  SORT_MIN,
+  SORT_MAX,
+  SORT_AVERAGE,
+};
+
+typedef struct {
+  int type;
+  double number;
+  char* string;
+  int index;
+  int count;
+  bool* matches; // Indexed by description, for description filters.
+} PrimaryFilter;
+
+typedef struct {
+  int type;
+  Filter* filter;
+} UnaryFilter;
+
+typedef struct {
+  int type;
+  Filter* left;
+  Filter* right;
+} BinaryFilter;
+
+struct Filter {
+  union {
+    PrimaryFilter primary;
+    UnaryFilter   unary;
+    BinaryFilter  binary;
+  };
+
+  int type;
+  bool parenthesized;
+};
 
 extern char* month_names[12];
 extern char* day_names[7];
 
+#define MAX_PERIODS 24
+
+typedef struct {
+  Date date;
+  double sum[MAX_ACCOUNTS];
+} Period;
+
 typedef struct {
   int type;
 
@@ -32,9 +143,96 @@ typedef struct {
   bool no_grid;
   bool percent;
   bool flat;
+  bool stats;
+  bool explain;
+  int limit; // Print only the first transactions, 0 for all.
+  int tail;  // Print only the last transactions, 0 for all.
+  bool at_present;
+  Date at;   // Balance view of the balances at the end of the date.
+  int year;  // Year closed by the checkpoint or archive command.
+  int group; // Key of the group command.
+  bool quiet; // Nothing is printed, the result is read with get_query_rows and get_query_periods.
+  Transaction transaction; // Of an add request, which has no session to enter it in.
+  char* description;       // Of the transaction, 0 without one.
 } Command;
 
+#define MAX_CHUNKS        (4 * MAX_THREADS)
+#define BITMAP_WORDS      ((2 * MAX_TRANSACTIONS + 63) / 64) // Enough for the postings.
+#define FILTER_ARENA_SIZE (160 * sizeof(Filter) + 10000)
+
+typedef struct Groups Groups;
+typedef struct ResultLookup ResultLookup;
+
+typedef struct {
+  int start;
+  int end;
+  int kept;
+  bool any_kept;
+  double sums[MAX_ACCOUNTS];       // Sum of every transaction in the chunk.
+  double first_sums[MAX_ACCOUNTS]; // Sum of the chunk before its first kept transaction.
+  double start_sums[MAX_ACCOUNTS]; // Running sums before the chunk.
+} Chunk;
+
+// The state of parsing and executing commands on a journal. Queries on the same journal are independent of each other, such that each
+// thread can run its own.
+typedef struct {
+  Journal* journal;
+  volatile sig_atomic_t cancelled; // Stops the executing command early, set from a signal handler or another thread.
+  Command* command;                // The executing command, for the pool tasks.
+
+  // The parsed command, with its filter in the filter arena until the next parse.
+  Command options;
+  char* error_message;
+  char arena[FILTER_ARENA_SIZE];
+  int arena_index;
+  Arena filter_data; // Variable size data, like description matches.
+
+  Transaction* transactions[MAX_TRANSACTIONS];
+  int transaction_count;
+  Period periods[MAX_PERIODS];
+  int period_count;
+
+  Chunk chunks[MAX_CHUNKS];
+  int chunk_count;
+  Transaction* kept_transactions[MAX_TRANSACTIONS];
+  Transaction* sort_buffer[MAX_TRANSACTIONS];
+  int heap[MAX_TRANSACTIONS]; // Row indices, for selecting -limit and -tail transactions.
+  int merge_buffers[2][2 * MAX_TRANSACTIONS];
+
+  u64 filter_bits[BITMAP_WORDS]; // The filter result by index in journal->raw_transactions, or in journal->postings when unified.
+  bool use_filter_bits;
+
+  // The postings of each transaction that the unified view prints, by index in journal->raw_transactions. Bit 0 is the source posting
+  // and bit 1 the destination posting.
+  u8 printed_sides[MAX_TRANSACTIONS];
+  bool rows_unified; // The last query was executed in the unified view.
+
+  // Running sums of the source and destination account after each transaction, by index in journal->raw_transactions.
+  double from_sums[MAX_TRANSACTIONS];
+  double to_sums[MAX_TRANSACTIONS];
+
+  double base_sums[MAX_ACCOUNTS]; // Running sums before the first row.
+  double running_sums[MAX_ACCOUNTS];
+  double initial_sums[MAX_ACCOUNTS];
+
+  Groups* groups;       // In group.c, allocated by the first group command.
+  ResultLookup* result; // In results.c, allocated by the first lookup.
+} Query;
+
+Query* query_create(Journal* journal);
+void   query_free(Query* query);
+void   execute_command(Query* query, Command* command);
+void   print_chars(int count, char c);
+void   print_number_in_field(bool print_zero, double number, int width, bool positive_color);
+int    get_query_rows(Query* query, Posting* rows);
+int    get_query_periods(Query* query, Period** result);
 
-void execute_command(Command* options);
+// In parser.c.
+double apply_filter(Filter* filter, Transaction* transaction);
+double apply_filter_posting(Filter* filter, Posting* posting);
+int    apply_filter_account(Filter* filter, Account* node);
+void   format_filter(Journal* journal, char* buffer, int capacity, Filter* filter, bool exact);
+void   print_filter(Journal* journal, Filter* filter);
+void   update_description_matches(Query* query, Filter* filter);
 
 #endif
@@ -31,17 +31,13 @@ int date_to_weekday(int d, int m, int y) {
 
 static int get_day_or_month_index(char* data, char** list, int count) {
   for (int i = 0; i < count; i++) {
-    debug("Comparing %.3s and %s\n", data, list[i]);
     if (strncasecmp(data, list[i], 3) == 0) return i + 1;
   }
   return 0;
 }
 
 int get_month(char* data) {
-  debug("Date : %s\n", data);
-  int r = get_day_or_month_index(data, month_names, 12);
-  debug("Date-: %s\n", data);
-  return r;
+  return get_day_or_month_index(data, month_names, 12);
 }
 
 int get_day(char* data) {
@@ -51,7 +47,8 @@ int get_day(char* data) {
 static void fix_incomplete_date(OptionsDate* date, bool end) {
   int day, month, year;
   time_t t = time(NULL);
-  struct tm tm  = *localtime(&t);
+  struct tm tm;
+  localtime_r(&t, &tm); // Server workers parse dates at the same time.
 
   day   = tm.tm_mday;
   month = tm.tm_mon + 1;
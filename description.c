@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+
+#include "description.h"
+#include <string.h>
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+
+// Descriptions are interned into journal.descriptions. Every unique string is stored once with its usage count, and transactions refer to it by index. Index 0 means no description.
+
+static u32 hash_string(char* data, int size) {
+  u32 hash = 2166136261u;
+  for (int i = 0; i < size; i++) {
+    hash ^= (u8)data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static u32 get_trigram_key(char* data) {
+  u32 a = tolower((u8)data[0]);
+  u32 b = tolower((u8)data[1]);
+  u32 c = tolower((u8)data[2]);
+  return ((a << 16) | (b << 8) | c) + 1;
+}
+
+static Trigram* find_trigram(Journal* journal, u32 key, bool insert) {
+  int slot = (key * 2654435761u) % TRIGRAM_TABLE_SIZE;
+
+  while (journal->trigrams[slot].key) {
+    if (journal->trigrams[slot].key == key) return &journal->trigrams[slot];
+    slot = (slot + 1) % TRIGRAM_TABLE_SIZE;
+  }
+
+  if (!insert) return 0;
+
+  if (4 * (journal->trigram_count + 1) > 3 * TRIGRAM_TABLE_SIZE) {
+    journal->trigram_overflow = true;
+    return 0;
+  }
+
+  journal->trigram_count++;
+  journal->trigrams[slot].key = key;
+  return &journal->trigrams[slot];
+}
+
+static void index_description(Journal* journal, int id) {
+  Description* description = &journal->descriptions[id];
+
+  for (int i = 0; i + 3 <= description->length; i++) {
+    Trigram* trigram = find_trigram(journal, get_trigram_key(description->string + i), true);
+    if (!trigram) return;
+
+    // The same trigram can appear several times in one description.
+    if (trigram->count && trigram->ids[trigram->count - 1] == id) continue;
+
+    if (trigram->count == trigram->capacity) {
+      int capacity = max(2 * trigram->capacity, 4);
+      int* ids = arena_push(&journal->arena, capacity * sizeof(int));
+      if (trigram->count) memcpy(ids, trigram->ids, trigram->count * sizeof(int));
+      trigram->ids = ids;
+      trigram->capacity = capacity;
+    }
+
+    trigram->ids[trigram->count++] = id;
+  }
+}
+
+// The string is not zero terminated, it is a view into the journal of the given length.
+int intern_description(Journal* journal, char* string, int length, Date* date) {
+  u32 hash = hash_string(string, length);
+  int slot = hash % DESCRIPTION_TABLE_SIZE;
+
+  while (journal->description_table[slot]) {
+    Description* description = &journal->descriptions[journal->description_table[slot]];
+
+    if (description->hash == hash && description->length == length && !memcmp(description->string, string, length)) {
+      description->count++;
+      if (date_is_bigger(date, &description->last_used)) description->last_used = *date;
+      return journal->description_table[slot];
+    }
+
+    slot = (slot + 1) % DESCRIPTION_TABLE_SIZE;
+  }
+
+  if (journal->description_count == 0) journal->description_count = 1;
+  assert(journal->description_count < MAX_DESCRIPTIONS);
+
+  int id = journal->description_count++;
+  Description* description = &journal->descriptions[id];
+
+  description->string    = string;
+  description->length    = length;
+  description->hash      = hash;
+  description->count     = 1;
+  description->last_used = *date;
+
+  journal->description_table[slot] = id;
+  index_description(journal, id);
+  return id;
+}
+
+Description* get_description(Journal* journal, int id) {
+  return id ? &journal->descriptions[id] : 0;
+}
+
+// Case insensitive search in a description, which is not zero terminated.
+static bool contains(Description* description, char* pattern, int length) {
+  for (int i = 0; i + length <= description->length; i++) {
+    if (!strncasecmp(description->string + i, pattern, length)) return true;
+  }
+  return false;
+}
+
+static int compare_trigram_size(const void* a, const void* b) {
+  return (*(Trigram**)a)->count - (*(Trigram**)b)->count;
+}
+
+// Keeps the ids that are also in the trigram posting list. Both lists are ascending.
+static int intersect(int* ids, int count, Trigram* trigram) {
+  int result = 0;
+  int j = 0;
+
+  for (int i = 0; i < count; i++) {
+    while (j < trigram->count && trigram->ids[j] < ids[i]) j++;
+    if (j == trigram->count) break;
+    if (trigram->ids[j] == ids[i]) ids[result++] = ids[i];
+  }
+
+  return result;
+}
+
+// Finds the descriptions containing the pattern, ignoring case. The indices are returned in ascending order.
+int search_descriptions(Journal* journal, char* pattern, int* ids) {
+  int length = strlen(pattern);
+  int count = 0;
+
+  if (length < 3 || journal->trigram_overflow) {
+    for (int i = 1; i < journal->description_count; i++) {
+      if (contains(&journal->descriptions[i], pattern, length)) ids[count++] = i;
+    }
+    return count;
+  }
+
+  // Intersect the posting lists of the pattern trigrams, starting with the shortest, then verify the candidates.
+  int trigram_count = length - 2;
+  Trigram* trigrams[trigram_count];
+
+  for (int i = 0; i < trigram_count; i++) {
+    trigrams[i] = find_trigram(journal, get_trigram_key(pattern + i), false);
+    if (!trigrams[i]) return 0;
+  }
+
+  qsort(trigrams, trigram_count, sizeof(Trigram*), compare_trigram_size);
+
+  count = trigrams[0]->count;
+  memcpy(ids, trigrams[0]->ids, count * sizeof(int));
+
+  for (int i = 1; i < trigram_count && count; i++) {
+    if (trigrams[i] != trigrams[i - 1]) count = intersect(ids, count, trigrams[i]);
+  }
+
+  int result = 0;
+  for (int i = 0; i < count; i++) {
+    if (contains(&journal->descriptions[ids[i]], pattern, length)) ids[result++] = ids[i];
+  }
+
+  return result;
+}
@@ -0,0 +1,10 @@
+#ifndef DESCRIPTION_H
+#define DESCRIPTION_H
+
+#include "journal.h"
+
+int   intern_description(Journal* journal, char* string, int length, Date* date);
+Description* get_description(Journal* journal, int id);
+int   search_descriptions(Journal* journal, char* pattern, int* ids);
+
+#endif
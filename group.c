@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+
+#include "group.h"
+#include "description.h"
+#include "output.h"
+#include "date.h"
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <assert.h>
+
+// The group command sums the kept rows per key, like a description or the counterparty account. The rows are aggregated in an open
+// addressing table keyed by the integer identity of the key, which is the interned description, the day, the month or the account, so no
+// strings are compared while aggregating. Only the groups are sorted and limited, the rows are read in date order.
+
+#define LEFT_INDENTATION 3
+#define NUMBER_WIDTH     11
+#define COUNT_WIDTH      6
+#define MAX_KEY_WIDTH    40
+#define MAX_GROUPS       MAX_DESCRIPTIONS // Descriptions are the key with the most values.
+#define GROUP_TABLE_SIZE (1 << 15)        // More than twice the number of groups, such that probe sequences stay short.
+
+typedef struct {
+  int key;
+  int count;
+  double sum;
+  double min;
+  double max;
+} Group;
+
+struct Groups {
+  Journal* journal;
+  Command* command; // The command whose groups are aggregated and sorted.
+  Group    groups[MAX_GROUPS];
+  int      group_count;
+  int      group_table[GROUP_TABLE_SIZE]; // Index in groups plus one, zero for a free slot.
+  Group*   sorted_groups[MAX_GROUPS];
+  Posting  rows[2 * MAX_TRANSACTIONS];
+};
+
+static char* column_names[] = { "description", "weekday", "day", "month", "from", "to" };
+
+static void start_line() {
+  set_x_cursor(LEFT_INDENTATION);
+}
+
+static int get_key(int type, Posting* row) {
+  Date* date = &row->transaction->date;
+
+  switch (type) {
+    case GROUP_DESCRIPTION: return row->transaction->description;
+    case GROUP_WEEKDAY:     return (date_to_weekday(date->day, date->month, date->year) + 6) % 7; // Monday first, like day_names.
+    case GROUP_DAY:         return date->day;
+    case GROUP_MONTH:       return date->month;
+    case GROUP_FROM:        return row->account;
+    case GROUP_TO:          return row->counterparty;
+  }
+
+  assert(0);
+  return 0;
+}
+
+static Group* find_group(Groups* groups, int key) {
+  int slot = ((u32)key * 2654435761u) % GROUP_TABLE_SIZE;
+
+  while (groups->group_table[slot]) {
+    Group* group = &groups->groups[groups->group_table[slot] - 1];
+    if (group->key == key) return group;
+    slot = (slot + 1) % GROUP_TABLE_SIZE;
+  }
+
+  assert(groups->group_count < MAX_GROUPS);
+  Group* group = &groups->groups[groups->group_count++];
+  *group = (Group) { key, 0, 0, 0, 0 };
+  groups->group_table[slot] = groups->group_count;
+  return group;
+}
+
+static void aggregate(Query* query, Groups* groups) {
+  Posting* rows = groups->rows;
+  groups->group_count = 0;
+  memset(groups->group_table, 0, sizeof(groups->group_table));
+
+  int count = get_query_rows(query, rows);
+
+  for (int i = 0; i < count; i++) {
+    Group* group = find_group(groups, get_key(groups->command->group, &rows[i]));
+    double amount = rows[i].amount;
+
+    if (!group->count || amount < group->min) group->min = amount;
+    if (!group->count || amount > group->max) group->max = amount;
+    group->sum += amount;
+    group->count++;
+  }
+}
+
+static int get_key_text(Journal* journal, int type, int key, char* buffer, int capacity) {
+  switch (type) {
+    case GROUP_DESCRIPTION: {
+      if (!key) return snprintf(buffer, capacity, "(none)");
+      Description* description = get_description(journal, key);
+      return snprintf(buffer, capacity, "%.*s", description->length, description->string);
+    }
+    case GROUP_WEEKDAY: return snprintf(buffer, capacity, "%s", day_names[key]);
+    case GROUP_DAY:     return snprintf(buffer, capacity, "%d", key);
+    case GROUP_MONTH:   return snprintf(buffer, capacity, "%s", month_names[key - 1]);
+    case GROUP_FROM:
+    case GROUP_TO:      return snprintf(buffer, capacity, "%s", journal->accounts[key].path);
+  }
+
+  assert(0);
+  return 0;
+}
+
+static double get_sort_value(Command* command, Group* group) {
+  switch (command->sort) {
+    case SORT_COUNT:   return group->count;
+    case SORT_AMOUNT:
+    case SORT_SUM:     return group->sum;
+    case SORT_MIN:     return group->min;
+    case SORT_MAX:     return group->max;
+    case SORT_AVERAGE: return group->sum / group->count;
+  }
+
+  return 0;
+}
+
+// By the sort option, ties and the other options by key. Descriptions are ordered by text, the other keys by value.
+static int compare_groups(const void* a, const void* b, void* data) {
+  Groups* groups = data;
+  Command* command = groups->command;
+  Group* x = *(Group**)a;
+  Group* y = *(Group**)b;
+
+  double difference = get_sort_value(command, x) - get_sort_value(command, y);
+  int order = (difference > 0) - (difference < 0);
+
+  if (!order && command->group == GROUP_DESCRIPTION && x->key && y->key) {
+    Description* left  = get_description(groups->journal, x->key);
+    Description* right = get_description(groups->journal, y->key);
+    order = strncasecmp(left->string, right->string, min(left->length, right->length));
+    if (!order) order = left->length - right->length;
+  }
+
+  if (!order) order = x->key - y->key;
+  return command->sort_reverse ? -order : order;
+}
+
+static void print_splitter(Command* command, int key_width) {
+  char splitter = command->no_grid ? '-' : '+';
+
+  start_line();
+  print_chars(key_width, '-');
+  print("-%c-", splitter);
+  print_chars(COUNT_WIDTH, '-');
+
+  for (int i = 0; i < 4; i++) {
+    print("-%c-", splitter);
+    print_chars(NUMBER_WIDTH, '-');
+  }
+
+  print("\n");
+}
+
+// Prints count, sum, min, max and average per group of the rows that the command kept. -limit and -tail select groups.
+void print_groups(Query* query, Command* command) {
+  if (!query->groups) {
+    query->groups = malloc(sizeof(Groups));
+    assert(query->groups);
+  }
+
+  Groups* groups = query->groups;
+  Journal* journal = query->journal;
+  Group** sorted_groups = groups->sorted_groups;
+  groups->journal = journal;
+  groups->command = command;
+  aggregate(query, groups);
+
+  for (int i = 0; i < groups->group_count; i++) sorted_groups[i] = &groups->groups[i];
+  qsort_r(sorted_groups, groups->group_count, sizeof(Group*), compare_groups, groups);
+
+  int first = 0;
+  int end = groups->group_count;
+  if (command->limit) end   = min(end, command->limit);
+  if (command->tail)  first = max(0, end - command->tail);
+
+  char key[MAX_KEY_WIDTH + 1];
+  int key_width = strlen(column_names[command->group]);
+
+  for (int i = first; i < end; i++) {
+    int width = get_key_text(journal, command->group, sorted_groups[i]->key, key, sizeof(key));
+    key_width = max(key_width, min(width, MAX_KEY_WIDTH));
+  }
+
+  char splitter = command->no_grid ? ' ' : '|';
+
+  print("\n");
+  start_line();
+  print("%-*s %c %*s", key_width, column_names[command->group], splitter, COUNT_WIDTH, "count");
+
+  char* names[] = { "sum", "min", "max", "average" };
+  for (int i = 0; i < 4; i++) print(" %c %*s", splitter, NUMBER_WIDTH, names[i]);
+  print("\n");
+
+  print_splitter(command, key_width);
+
+  for (int i = first; i < end; i++) {
+    if (query->cancelled) return;
+
+    Group* group = sorted_groups[i];
+    get_key_text(journal, command->group, group->key, key, sizeof(key));
+
+    start_line();
+    print("%-*s %c %*d", key_width, key, splitter, COUNT_WIDTH, group->count);
+
+    double values[] = { group->sum, group->min, group->max, group->sum / group->count };
+    for (int j = 0; j < 4; j++) {
+      print(" %c ", splitter);
+      print_number_in_field(true, values[j], NUMBER_WIDTH, false);
+    }
+
+    print("\n");
+  }
+}
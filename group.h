@@ -0,0 +1,17 @@
+#ifndef GROUP_H
+#define GROUP_H
+
+#include "command.h"
+
+enum {
+  GROUP_DESCRIPTION,
+  GROUP_WEEKDAY,
+  GROUP_DAY,
+  GROUP_MONTH,
+  GROUP_FROM,
+  GROUP_TO,
+};
+
+void print_groups(Query* query, Command* command);
+
+#endif
@@ -3,6 +3,7 @@
 #include "terminal.h"
 #include "suggestions.h"
 #include "basic.h"
+#include "trace.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,6 +22,8 @@ static int position;
 static int undo;
 
 void load_history_from_file() {
+  trace_begin("load_history_from_file");
+
   FILE* file = fopen(HISTORY_PATH, "r");
   assert(file);
   size_t n = 0;
@@ -48,6 +51,8 @@ void load_history_from_file() {
   }
 
   if (line) free(line);
+
+  trace_end("load_history_from_file");
 }
 
 static void move(int relative) {
@@ -3,11 +3,10 @@
 
 #include "basic.h"
 #include "text.h"
+#include "parser.h"
 
 typedef struct Input Input;
 
-#define INPUT_SIZE 1024
-
 struct Input {
   char data[INPUT_SIZE];
   int size;
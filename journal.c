@@ -4,34 +4,224 @@
 #include "stdlib.h"
 #include "assert.h"
 #include "basic.h"
-#include "terminal.h"
+#include "output.h"
+#include "stats.h"
+#include "trace.h"
+#include "pool.h"
+#include "description.h"
+#include "archive.h"
+#include "planner.h"
+#include "balances.h"
+#include "results.h"
+#include "bitmap.h"
 #include <string.h>
+#include <math.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#define MIN_PARSE_CHUNK_SIZE (256 << 10) // About 4 ms of parsing, such that starting a chunk is a small part of its cost.
+
+typedef struct {
+  char* start;
+  char* end;   // Start of the next chunk.
+  int first;   // Index of the first transaction in journal.raw_transactions.
+  int count;
+  double monthly_budgets[MAX_ACCOUNTS];
+  double yearly_budgets[MAX_ACCOUNTS];
+} ParseChunk;
+
+// The chunks of one parse, with the descriptions of the parsed transactions until they are interned in file order.
+typedef struct {
+  Journal* journal;
+  ParseChunk chunks[MAX_THREADS];
+  char* descriptions[MAX_TRANSACTIONS];
+  int   description_lengths[MAX_TRANSACTIONS];
+} Parse;
+
+static void add_parsed(Journal* journal, char* data, size_t size) {
+  if (size >= PARSED_TAIL_SIZE) {
+    memcpy(journal->parsed_tail, data + size - PARSED_TAIL_SIZE, PARSED_TAIL_SIZE);
+    journal->parsed_tail_size = PARSED_TAIL_SIZE;
+  } else {
+    int keep = min(journal->parsed_tail_size, PARSED_TAIL_SIZE - (int)size);
+    memmove(journal->parsed_tail, journal->parsed_tail + journal->parsed_tail_size - keep, keep);
+    memcpy(journal->parsed_tail + keep, data, size);
+    journal->parsed_tail_size = keep + size;
+  }
+
+  journal->parsed_size += size;
+}
+
+// Locks the journal file against appends by other sessions, and parses what they appended since it was parsed, such that an entry
+// written now follows the parsed part. The file may be replaced while waiting for the lock, in which case the new file is locked.
+int journal_lock(Journal* journal) {
+  while (true) {
+    int file = open(journal->path, O_WRONLY | O_APPEND);
+    assert(file >= 0);
+    assert(flock(file, LOCK_EX) == 0);
+
+    struct stat locked, current;
+    assert(fstat(file, &locked) == 0);
+
+    if (stat(journal->path, &current) == 0 && current.st_ino == locked.st_ino) {
+      if (journal_is_stale(journal)) journal_reload(journal);
+      return file;
+    }
+
+    close(file);
+  }
+}
+
+void journal_unlock(int file) {
+  close(file);
+}
+
+// Writes the line to the locked journal file in one write, such that it is not interleaved with appends by other programs.
+static void append_line(int file, char* line) {
+  ssize_t size = strlen(line);
+  assert(write(file, line, size) == size);
+}
+
+// Maps the journal file read only, followed by at least one zero byte. The mapping is placed at the start of an anonymous mapping one page
+// larger, whose remaining bytes are zero, so the content can be read as a zero terminated string without copying it.
+//
+// The mapping shares the pages of the file. Appends and files replaced by a rename leave it valid, but a file that is written in place
+// changes the mapped content, and reading past the end of a truncated file raises SIGBUS. So the journal is mapped again as soon as the
+// file is seen to have changed: when the watch reports it while no input is waiting, and before every command and speculative execution,
+// with the speculation stopped. Editors that write the file in place while a command runs are not supported.
+static char* map_journal(Journal* journal, size_t* size) {
+  trace_begin("map journal");
+
+  if (journal->mapping) munmap(journal->mapping, journal->mapping_size);
+
+  int file = open(journal->path, O_RDONLY);
+  assert(file >= 0);
+
+  struct stat info;
+  assert(fstat(file, &info) == 0);
+  *size = info.st_size;
+  journal->parsed_inode = info.st_ino;
+  journal->parsed_time  = info.st_mtim;
+
+  long page = sysconf(_SC_PAGESIZE);
+  journal->mapping_size = (*size / page + 1) * page;
+  journal->mapping = mmap(0, journal->mapping_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(journal->mapping != MAP_FAILED);
+
+  if (*size) assert(mmap(journal->mapping, *size, PROT_READ, MAP_PRIVATE | MAP_FIXED, file, 0) != MAP_FAILED);
+  close(file);
+
+  journal->parsed_size = 0;
+  journal->parsed_tail_size = 0;
+  add_parsed(journal, journal->mapping, *size);
+
+  trace_end("map journal");
+  return journal->mapping;
+}
+
+static void add_postings(Journal* journal, Transaction* transaction) {
+  Posting* postings = &journal->postings[2 * (transaction - journal->raw_transactions)];
+  postings[0] = (Posting) { transaction, transaction->from, transaction->to, -transaction->amount };
+  postings[1] = (Posting) { transaction, transaction->to, transaction->from, transaction->amount };
+}
+
+// Parses the transaction entry at the cursor, after the $, as the last transaction of the journal.
+static void add_entry(Journal* journal, char** cursor) {
+  assert(journal->raw_transaction_count < MAX_TRANSACTIONS);
+  Transaction* added = &journal->raw_transactions[journal->raw_transaction_count++];
+
+  char* description;
+  int description_length;
+  journal_parse_transaction(journal, cursor, added, &description, &description_length);
 
-Journal journal;
-
-static char* read_entire_file(const char* path) {
-  FILE* file = fopen(path, "rb");
-  assert(file);
-  assert(fseek(file, 0, SEEK_END) == 0);
-  long int size = ftell(file);
-  assert(size >= 0);
-  assert(fseek(file, 0, SEEK_SET) == 0);
-  char* data = malloc(size + 1);
-  assert(fread(data, 1, size, file) == (size_t)size);
-  data[size] = 0;
-  fclose(file);
-  return data;
-}
-
-void journal_append_transaction(Transaction* t) {
-  FILE* file = fopen(JOURNAL_PATH, "a");
-  assert(file);
-  fprintf(file, "$ %02d.%02d.%d %s %s %.2lf '", t->date.day, t->date.month, t->date.year, journal.accounts[t->from].path, journal.accounts[t->to].path, t->amount);
-  if (t->description) fprintf(file, "%s", t->description);
-  fprintf(file, "'");
-  if (t->reference >= 0) fprintf(file, " %d", t->reference);
-  fprintf(file, "\n");
-  fclose(file);
+  added->description = description ? intern_description(journal, description, description_length, &added->date) : 0;
+  journal->accounts[added->from].from_count++;
+  journal->accounts[added->to].to_count++;
+  add_postings(journal, added);
+}
+
+// Writes the transaction to the journal file and parses the written line into the journal, together with the entries appended by other
+// sessions before it, without reading the rest of the file again.
+void journal_append_transaction(Journal* journal, Transaction* t, char* description) {
+  char reference[16] = "";
+  if (t->reference >= 0) snprintf(reference, sizeof(reference), " %d", t->reference);
+
+  char line[2 * MAX_ACCOUNT_LENGTH + 2048];
+  char* from = journal->accounts[t->from].path;
+  char* to   = journal->accounts[t->to].path;
+  if (!description) description = "";
+
+  snprintf(line, sizeof(line), "$ %02d.%02d.%d %s %s %.2lf '%s'%s\n", t->date.day, t->date.month, t->date.year, from, to, t->amount,
+           description, reference);
+
+  int file = journal_lock(journal);
+  append_line(file, line);
+  journal_reload(journal);
+  journal_unlock(file);
+}
+
+// Parses the transaction entries of the text into the journal. The text must stay allocated, since the descriptions point into it.
+// This changes the journal like a parse does, such that derived indices are rebuilt.
+void journal_add_entries(Journal* journal, char* text) {
+  char* cursor = text;
+
+  while (*cursor) {
+    if (skip_char(&cursor, '$')) {
+      add_entry(journal, &cursor);
+    } else {
+      skip_line(&cursor);
+    }
+  }
+
+  journal->generation++;
+}
+
+// Writes the balances of every account at the end of the date as a checkpoint entry to the locked journal file. The loaded journal is not
+// changed, a checkpoint is only read when the journal is loaded with CASH_SINCE.
+void journal_append_checkpoint(Journal* journal, int file, Date* date, double* sums) {
+  char line[MAX_ACCOUNTS * (MAX_ACCOUNT_LENGTH + 32)];
+  int size = snprintf(line, sizeof(line), "= %02d.%02d.%d", date->day, date->month, date->year);
+
+  for (int i = 0; i < journal->account_count; i++) {
+    Account* account = &journal->accounts[i];
+    if (account->is_category || fabs(sums[i]) < 0.005) continue;
+    size += snprintf(&line[size], sizeof(line) - size, " %s %.2lf", account->path, sums[i]);
+  }
+
+  snprintf(&line[size], sizeof(line) - size, "\n");
+  append_line(file, line);
+  journal_reload(journal);
+}
+
+// The budget of a category is the sum of the budgets of its accounts.
+static void compute_budget_sum(Account* account, double* y, double* m) {
+  double y_sum = 0;
+  double m_sum = 0;
+
+  if (!account->is_category) {
+    *y = account->yearly_budget;
+    *m = account->monthly_budget;
+    return;
+  }
+
+  Account* child = account->childs;
+  while (child) {
+    double y, m;
+    compute_budget_sum(child, &y, &m);
+    y_sum += y;
+    m_sum += m;
+
+    child = child->next;
+  }
+
+  account->yearly_budget = y_sum;
+  account->monthly_budget = m_sum;
+  if (y) *y = y_sum;
+  if (m) *m = m_sum;
 }
 
 static void build_account_path(char* dest, Account* account) {
@@ -46,17 +236,18 @@ static void insert_account(Account** next_pointer, Account* node) {
   *next_pointer = node;
 }
 
-static Account* parse_account_group(Account* parent, char** cursor, char* name, int level) {
-  int index = journal.account_count++;
+static Account* parse_account_group(Journal* journal, Account* parent, char** cursor, char* name, int name_length, int level) {
+  int index = journal->account_count++;
 
-  Account* account = &journal.accounts[index];
+  Account* account = &journal->accounts[index];
   account->parent = parent;
   account->index = index;
   account->level = level;
 
   build_account_path(account->path, parent);
   account->name = account->path + strlen(account->path);
-  strcat(account->path, name);
+  assert(account->name - account->path + name_length < MAX_ACCOUNT_LENGTH);
+  strncat(account->path, name, name_length);
 
   account->name_length = strlen(account->name);
   account->path_length = strlen(account->path);
@@ -64,17 +255,22 @@ static Account* parse_account_group(Account* parent, char** cursor, char* name,
   if (skip_char(cursor, '{')) {
     account->is_category = true;
     while (!skip_char(cursor, '}')) {
-      Account* subaccount = parse_account_group(account, cursor, get_string(cursor), level + 1);
+      int name_length;
+      char* name = get_string_size(cursor, &name_length);
+      assert(name);
+      Account* subaccount = parse_account_group(journal, account, cursor, name, name_length, level + 1);
       insert_account(&account->childs, subaccount);
     }
   }
 
-  account->count = journal.account_count - account->index;
+  account->count = journal->account_count - account->index;
   return account;
 }
 
-static void parse_accounts(char** cursor) {
-  journal.root_account = parse_account_group(0, cursor, "Accounts", 0);
+static void parse_accounts(Journal* journal, char** cursor) {
+  trace_begin("parse accounts");
+  journal->root_account = parse_account_group(journal, 0, cursor, "Accounts", strlen("Accounts"), 0);
+  trace_end("parse accounts");
 }
 
 static Date parse_date(char** cursor) {
@@ -87,93 +283,400 @@ static Date parse_date(char** cursor) {
   return date;
 }
 
-static int parse_account_reference(char** cursor) {
-  char* string = get_string(cursor);
+static int parse_account_reference(Journal* journal, char** cursor) {
+  int size;
+  char* string = get_string_size(cursor, &size);
+  assert(string);
 
-  for (int i = 0; i < journal.account_count; i++) {
-    Account* account = &journal.accounts[i];
+  for (int i = 0; i < journal->account_count; i++) {
+    Account* account = &journal->accounts[i];
     if (account->is_category) continue;
-    if (!strcmp(string, account->path)) return i;
+    if (account->path_length == size && !memcmp(string, account->path, size)) return i;
   }
 
   assert(0);
 }
 
-static char* parse_description(char** cursor) {
-  char* data = get_quoted_string(cursor);
-
-  if (*data) {
-    data = string_save(data);
-    return data;
-  } else {
-    return 0;
-  }
+static char* parse_description(char** cursor, int* length) {
+  char* data = get_quoted_string_size(cursor, length);
+  assert(data);
+  return (*length) ? data : 0;
 }
 
 static int parse_reference(char** cursor) {
   int result = -1;
   skip_blank(cursor);
 
-  if (is_number(**cursor)) {
-    int n;
-    sscanf(*cursor, "%d%n", &result, &n);
-    *cursor += n;
-  }
+  if (is_number(**cursor)) result = get_number(cursor);
 
   return result;
 }
 
-static void parse_transaction(char** cursor) {
-  Transaction* transaction = &journal.raw_transactions[journal.raw_transaction_count++];
-
+// The entry is only read, the description is a view into it of the given length.
+void journal_parse_transaction(Journal* journal, char** cursor, Transaction* transaction, char** description, int* description_length) {
   transaction->date        = parse_date(cursor);
-  transaction->from        = parse_account_reference(cursor);
-  transaction->to          = parse_account_reference(cursor);
+  transaction->from        = parse_account_reference(journal, cursor);
+  transaction->to          = parse_account_reference(journal, cursor);
   transaction->amount      = get_double(cursor);
-  transaction->description = parse_description(cursor);
+  *description             = parse_description(cursor, description_length);
   transaction->reference   = parse_reference(cursor);
 }
 
-static void parse_budget(char** cursor) {
+static void parse_budget(Journal* journal, char** cursor, ParseChunk* chunk) {
   if (skip_char(cursor, 'm')) {
-    int account = parse_account_reference(cursor);
-    journal.accounts[account].monthly_budget += get_double(cursor);
+    int account = parse_account_reference(journal, cursor);
+    chunk->monthly_budgets[account] += get_double(cursor);
   } else if (skip_char(cursor, 'y')) {
-    int account = parse_account_reference(cursor);
-    journal.accounts[account].yearly_budget += get_double(cursor);
+    int account = parse_account_reference(journal, cursor);
+    chunk->yearly_budgets[account] += get_double(cursor);
   } else {
     assert(0 && "missing m or y budget specifier");
   }
 }
 
-void journal_parse() {
-  char* content = read_entire_file(JOURNAL_PATH);
-  char* cursor = content;
+// True if the transaction entry is summed in the checkpoint the journal is loaded from, or is in the archive already, which is the case
+// when archiving was interrupted before the journal file was replaced.
+static bool is_skipped(Journal* journal, char* entry) {
+  bool checkpointed = journal->checkpoint_entry && entry <= journal->checkpoint_entry;
+  bool archived = entry - journal->mapping < journal->archived_size;
+  if (!checkpointed && !archived) return false;
+
+  char* cursor = entry + 1;
+  Date date = parse_date(&cursor);
+  return (checkpointed && !date_is_bigger(&date, &journal->opening_date)) || (archived && !date_is_bigger(&date, &journal->archived_date));
+}
+
+// Reads the balances of a checkpoint entry, which has the format = [date] [account] [amount] [account] [amount] ... on one line.
+// The content is not modified, since the entries are split into chunks afterwards.
+static void parse_checkpoint(Journal* journal, char* cursor) {
+  cursor++;
+  journal->opening_date = parse_date(&cursor);
+
+  while (true) {
+    while (*cursor == ' ' || *cursor == '\t') cursor++;
+    if (!*cursor || *cursor == '\n' || *cursor == '\r') break;
+
+    int size;
+    char* path = get_string_size(&cursor, &size);
+    assert(path && "expecting an account in the checkpoint");
+
+    int account = -1;
+    for (int i = 0; i < journal->account_count; i++) {
+      Account* node = &journal->accounts[i];
+      if (!node->is_category && node->path_length == size && !strncmp(node->path, path, size)) account = i;
+    }
+    assert(account >= 0 && "unknown account in the checkpoint");
 
-  memset(&journal, 0, sizeof(journal));
+    char* end;
+    journal->opening_sums[account] = strtod(cursor, &end);
+    assert(end != cursor);
+    cursor = end;
+  }
+
+  journal->opening_present = true;
+}
+
+// Finds the latest checkpoint dated before the year, from which the journal is loaded. The checkpoint includes the archived transactions,
+// so a checkpoint before the end of the archive is not used, and the archive is not used when there is a checkpoint.
+static void find_checkpoint(Journal* journal, char* cursor, int year) {
+  Date since = { 1, 1, year };
+  Date latest = { 0 };
+  Date archive_end;
+  bool archived = archive_get_end(journal, &archive_end);
 
   while (*cursor) {
-    if (skip_char(&cursor, '@')) {
-      parse_accounts(&cursor);
+    skip_blank(&cursor);
+
+    if (*cursor == '=') {
+      char* entry = cursor++;
+      Date date = parse_date(&cursor);
+
+      bool covered = !archived || !date_is_smaller(&date, &archive_end);
+      if (covered && date_is_smaller(&date, &since) && (!journal->checkpoint_entry || !date_is_smaller(&date, &latest))) {
+        journal->checkpoint_entry = entry;
+        latest = date;
+      }
+    }
+
+    skip_line(&cursor);
+  }
+
+  if (journal->checkpoint_entry) {
+    parse_checkpoint(journal, journal->checkpoint_entry);
+    archive_discard(journal);
+  }
+}
+
+// Counts the transaction lines of a chunk, such that every chunk can parse directly into its place in journal.raw_transactions.
+static void count_chunk(int index, void* data) {
+  Parse* parse = data;
+  ParseChunk* chunk = &parse->chunks[index];
+  char* cursor = chunk->start;
+
+  chunk->count = 0;
+
+  while (cursor < chunk->end) {
+    skip_blank(&cursor);
+    if (cursor < chunk->end && *cursor == '$' && !is_skipped(parse->journal, cursor)) chunk->count++;
+    skip_line(&cursor);
+  }
+}
+
+static void parse_chunk(int index, void* data) {
+  Parse* parse = data;
+  Journal* journal = parse->journal;
+  ParseChunk* chunk = &parse->chunks[index];
+  char* cursor = chunk->start;
+  int count = 0;
+
+  memset(chunk->monthly_budgets, 0, sizeof(chunk->monthly_budgets));
+  memset(chunk->yearly_budgets,  0, sizeof(chunk->yearly_budgets));
+
+  while (cursor < chunk->end) {
+    skip_blank(&cursor);
+    if (cursor >= chunk->end) break;
+
+    if (*cursor == '$' && is_skipped(journal, cursor)) {
+      skip_line(&cursor);
     } else if (skip_char(&cursor, '$')) {
-      parse_transaction(&cursor);
+      assert(count < chunk->count);
+      int index = chunk->first + count++;
+      journal_parse_transaction(journal, &cursor, &journal->raw_transactions[index], &parse->descriptions[index],
+                                &parse->description_lengths[index]);
+    } else if (skip_char(&cursor, '?')) {
+      parse_budget(journal, &cursor, chunk);
+    } else {
+      assert(*cursor != '@' && "the account block must be the first entry");
+      skip_line(&cursor);
+    }
+  }
+}
+
+// Splits the entries after the account block into line aligned chunks. The content is read only, so each chunk ends where the next starts.
+static int split_entries(ParseChunk* chunks, char* start, char* end) {
+  long size = end - start;
+  int count = limit((int)(size / MIN_PARSE_CHUNK_SIZE), 1, pool_thread_count());
+  char* previous = start;
+
+  for (int i = 0; i < count; i++) {
+    chunks[i].start = previous;
+
+    char* split = start + size * (i + 1) / count;
+    if (split < previous) split = previous;
+    while (split < end && split[-1] != '\n') split++;
+
+    chunks[i].end = (i + 1 < count) ? split : end;
+    previous = split;
+  }
+
+  return count;
+}
+void journal_parse(Journal* journal) {
+  stats_begin(STAGE_PARSE);
+
+  memset(journal, 0, offsetof(Journal, path));
+  journal->generation++;
+  arena_reset(&journal->arena);
+
+  size_t size;
+  char* content = map_journal(journal, &size);
+  char* end = content + size;
+  char* cursor = content;
+
+  trace_begin("parse entries");
+
+  // Every entry references the accounts, so the account block is parsed first. The remaining lines are independent.
+  while (*cursor && !journal->root_account) {
+    if (skip_char(&cursor, '@')) {
+      parse_accounts(journal, &cursor);
+    } else {
+      skip_line(&cursor);
+    }
+  }
+
+  // Only the index of the archive is read, its transactions are parsed when a query needs them.
+  archive_open(journal);
+  journal->archived_size = archive_get_covered(journal, journal->parsed_inode, size, &journal->archived_date);
+
+  // Day to day sessions can start from a checkpoint, such that older transactions are not parsed.
+  journal->checkpoint_entry = 0;
+  char* since = getenv("CASH_SINCE");
+  if (since) find_checkpoint(journal, cursor, atoi(since));
+
+  Parse* parse = malloc(sizeof(Parse));
+  assert(parse);
+  parse->journal = journal;
+
+  int chunk_count = split_entries(parse->chunks, cursor, end);
+  pool_run(count_chunk, chunk_count, parse);
+
+  for (int i = 0; i < chunk_count; i++) {
+    parse->chunks[i].first = journal->raw_transaction_count;
+    journal->raw_transaction_count += parse->chunks[i].count;
+  }
+
+  assert(journal->raw_transaction_count <= MAX_TRANSACTIONS);
+  pool_run(parse_chunk, chunk_count, parse);
+
+  for (int i = 0; i < chunk_count; i++) {
+    ParseChunk* chunk = &parse->chunks[i];
+
+    for (int j = 0; j < journal->account_count; j++) {
+      journal->accounts[j].monthly_budget += chunk->monthly_budgets[j];
+      journal->accounts[j].yearly_budget  += chunk->yearly_budgets[j];
+    }
+  }
+
+  if (journal->root_account) compute_budget_sum(journal->root_account, 0, 0);
+
+  trace_end("parse entries");
+
+  // Interning is done in file order, such that description indices do not depend on the chunking. The account usage counts, used
+  // by the filter optimizer, and the postings are made in the same pass.
+  trace_begin("intern descriptions");
+
+  for (int i = 0; i < journal->raw_transaction_count; i++) {
+    Transaction* transaction = &journal->raw_transactions[i];
+    char* description = parse->descriptions[i];
+    transaction->description = description ? intern_description(journal, description, parse->description_lengths[i], &transaction->date) : 0;
+
+    journal->accounts[transaction->from].from_count++;
+    journal->accounts[transaction->to].to_count++;
+    add_postings(journal, transaction);
+  }
+
+  trace_end("intern descriptions");
+
+  free(parse);
+  stats_end(STAGE_PARSE);
+}
+
+// Parses the journal file at the path, returns 0 if it can not be read. The journal is freed with journal_free.
+Journal* journal_open(const char* path) {
+  if (strlen(path) >= PATH_MAX || access(path, R_OK) != 0) return 0;
+
+  Journal* journal = calloc(1, sizeof(Journal));
+  assert(journal);
+  strcpy(journal->path, path);
+
+  journal->archive  = archive_create();
+  journal->indices  = planner_create();
+  journal->balances = balances_create();
+  journal->results  = results_create();
+  journal->bitmaps  = bitmap_create();
+
+  journal_parse(journal);
+  return journal;
+}
+
+// Releases the mapping of the journal file, the memory of the parsed journal and everything derived from it.
+void journal_free(Journal* journal) {
+  if (journal->mapping) munmap(journal->mapping, journal->mapping_size);
+  arena_free(&journal->arena);
+
+  free(journal->archive);
+  free(journal->indices);
+  free(journal->balances);
+  free(journal->results);
+  free(journal->bitmaps);
+  free(journal);
+}
+
+static bool same_time(struct timespec* a, struct timespec* b) {
+  return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+// True if the journal file, or the archive, is not what the journal was parsed from.
+bool journal_is_stale(Journal* journal) {
+  struct stat info;
+  if (stat(journal->path, &info) != 0) return false; // Being replaced.
+
+  return archive_is_stale(journal) || info.st_ino != journal->parsed_inode || (size_t)info.st_size != journal->parsed_size ||
+         !same_time(&info.st_mtim, &journal->parsed_time);
+}
+
+// True if the parsed part of the file is unchanged and ends a line, such that the rest of the file can be parsed alone.
+static bool is_appended(Journal* journal, int file, struct stat* info) {
+  if (archive_is_stale(journal) || info->st_ino != journal->parsed_inode || (size_t)info->st_size <= journal->parsed_size) return false;
+  if (journal->parsed_tail_size && journal->parsed_tail[journal->parsed_tail_size - 1] != '\n') return false;
+
+  char tail[PARSED_TAIL_SIZE];
+  int tail_size = journal->parsed_tail_size;
+  off_t offset = journal->parsed_size - tail_size;
+  return pread(file, tail, tail_size, offset) == tail_size && !memcmp(tail, journal->parsed_tail, tail_size);
+}
+
+// Parses the entries appended to the journal file since it was parsed, like appends of this session, such that derived indices are
+// extended instead of rebuilt. A changed file, or an appended account block, is parsed again. A last line that is still being
+// written is left for the next time.
+void journal_reload(Journal* journal) {
+  int file = open(journal->path, O_RDONLY);
+  if (file < 0) return;
+
+  struct stat info;
+  assert(fstat(file, &info) == 0);
+
+  if (!is_appended(journal, file, &info)) {
+    close(file);
+    journal_parse(journal);
+    return;
+  }
+
+  trace_begin("parse appended");
+
+  size_t size = info.st_size - journal->parsed_size;
+  char* text = arena_push(&journal->arena, size + 1);
+  assert(pread(file, text, size, journal->parsed_size) == (ssize_t)size);
+  close(file);
+
+  while (size && text[size - 1] != '\n') size--;
+  text[size] = 0;
+
+  for (char* cursor = text; *cursor; skip_line(&cursor)) {
+    skip_blank(&cursor);
+    if (*cursor == '@') {
+      trace_end("parse appended");
+      journal_parse(journal);
+      return;
+    }
+  }
+
+  ParseChunk chunk;
+  memset(chunk.monthly_budgets, 0, sizeof(chunk.monthly_budgets));
+  memset(chunk.yearly_budgets,  0, sizeof(chunk.yearly_budgets));
+
+  char* cursor = text;
+
+  while (*cursor) {
+    if (skip_char(&cursor, '$')) {
+      add_entry(journal, &cursor);
     } else if (skip_char(&cursor, '?')) {
-      parse_budget(&cursor);
+      parse_budget(journal, &cursor, &chunk);
     } else {
       skip_line(&cursor);
     }
   }
 
-  free(content);
+  for (int i = 0; i < journal->account_count; i++) {
+    journal->accounts[i].monthly_budget += chunk.monthly_budgets[i];
+    journal->accounts[i].yearly_budget  += chunk.yearly_budgets[i];
+  }
+
+  if (journal->root_account) compute_budget_sum(journal->root_account, 0, 0);
+
+  add_parsed(journal, text, size);
+  if (journal->parsed_size == (size_t)info.st_size) journal->parsed_time = info.st_mtim;
+
+  trace_end("parse appended");
 }
 
-static void merge(Transaction** transactions, int start, int middle, int end, GetFirstTransaction get_first, bool reverse) {
+static void merge(Transaction** transactions, Transaction** buffer, int start, int middle, int end, GetFirstTransaction get_first,
+                  bool reverse) {
   int left_size  = middle - start;
   int right_size = end - middle;
 
-  Transaction** left_data  = &journal.sort_buffer[0];
-  Transaction** right_data = &journal.sort_buffer[left_size];
-
+  Transaction** left_data  = &buffer[0];
+  Transaction** right_data = &buffer[left_size];
   for (int i = 0; i < left_size;  i++) left_data [i] = transactions[start  + i];
   for (int i = 0; i < right_size; i++) right_data[i] = transactions[middle + i];
 
@@ -201,23 +704,24 @@ static void merge(Transaction** transactions, int start, int middle, int end, Ge
   while (right_index < right_size) transactions[dest_index++] = right_data[right_index++];
 }
 
-static void merge_sort(Transaction** transactions, int start, int end, GetFirstTransaction get_first, bool reverse) {
+static void merge_sort(Transaction** transactions, Transaction** buffer, int start, int end, GetFirstTransaction get_first, bool reverse) {
   if ((start + 1) >= end) return;
   int middle = start + (end - start) / 2;
 
-  merge_sort(transactions, start,  middle, get_first, reverse);
-  merge_sort(transactions, middle, end,    get_first, reverse);
+  merge_sort(transactions, buffer, start,  middle, get_first, reverse);
+  merge_sort(transactions, buffer, middle, end,    get_first, reverse);
 
-  merge(transactions, start, middle, end, get_first, reverse);
+  merge(transactions, buffer, start, middle, end, get_first, reverse);
 }
 
-void journal_sort_transactions(Transaction** transactions, int count, GetFirstTransaction get_first, bool reverse) {
-  merge_sort(transactions, 0, count, get_first, reverse);
+// The buffer holds count transactions while they are merged.
+void journal_sort_transactions(Transaction** transactions, int count, Transaction** buffer, GetFirstTransaction get_first, bool reverse) {
+  merge_sort(transactions, buffer, 0, count, get_first, reverse);
 }
 
-Account* get_account(char* name) {
-  for (int i = 0; i < journal.account_count; i++) {
-    Account* node = &journal.accounts[i];
+Account* get_account(Journal* journal, char* name) {
+  for (int i = 0; i < journal->account_count; i++) {
+    Account* node = &journal->accounts[i];
     if (!strcmp(name, node->path)) {
       return node;
     }
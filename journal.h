@@ -1,16 +1,33 @@
 #ifndef JOURNAL_H
 #define JOURNAL_H
 
+#include "basic.h"
 #include "date.h"
+#include "arena.h"
 #include <stdbool.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
 
 #define MAX_ACCOUNT_LENGTH 64
 #define MAX_ACCOUNTS       64
 #define MAX_TRANSACTIONS   5000
+#define MAX_DESCRIPTIONS   (MAX_TRANSACTIONS + 1)
+#define DESCRIPTION_TABLE_SIZE (4 * MAX_DESCRIPTIONS)
+#define TRIGRAM_TABLE_SIZE (1 << 17)
+#define PARSED_TAIL_SIZE   64
 
 typedef struct Account Account;
 typedef struct Journal Journal;
 typedef struct Transaction Transaction;
+typedef struct Posting Posting;
+typedef struct Description Description;
+typedef struct Trigram Trigram;
+typedef struct Archive Archive;         // In archive.c.
+typedef struct Indices Indices;         // In planner.c.
+typedef struct Balances Balances;       // In balances.c.
+typedef struct ResultCache ResultCache; // In results.c.
+typedef struct BitmapCache BitmapCache; // In bitmap.c.
 
 struct Account {
   char  path[MAX_ACCOUNT_LENGTH]; // Ex: Expenses.Trips.Abroad
@@ -28,40 +45,109 @@ struct Account {
   int index; // Index in jounal.accounts
   int count; // This account plus all subaccounts.
 
+  int from_count; // Transactions with this account as source.
+  int to_count;   // Transactions with this account as destination.
+
   Account* parent;
   Account* next;
   Account* childs;
 };
 
+struct Description {
+  char* string; // Not zero terminated, a view into the journal.
+  int   length;
+  u32   hash;
+  int   count; // Number of transactions using it.
+  Date  last_used;
+};
+
+struct Trigram {
+  u32  key; // Three case folded characters, plus one such that zero is free.
+  int* ids; // Ascending description indices, in the journal arena.
+  int  count;
+  int  capacity;
+};
+
 struct Transaction {
   Date   date;
-  char*  description;
+  int    description; // Index in journal.descriptions, 0 if there is none.
   double amount;
   int    from;
   int    to;
   int    reference;
-  double from_sum;
-  double to_sum;
-  bool   unify_print_from;
-  bool   unify_print_to;
 };
 
+// One side of a transaction as seen from its account, which is how the unified view shows it. The source side has the negated amount.
+struct Posting {
+  Transaction* transaction;
+  int    account;
+  int    counterparty;
+  double amount;
+};
+
+// A journal file with everything the engine derives from it. Every function of the engine is given the journal it works on, such that
+// a process can open several journals.
 struct Journal {
   Account* root_account;
   Account  accounts[MAX_ACCOUNT_LENGTH];
   int      account_count;
 
-  Transaction* sort_buffer[MAX_TRANSACTIONS];
   Transaction  raw_transactions[MAX_TRANSACTIONS];
   int          raw_transaction_count;
+  Posting      postings[2 * MAX_TRANSACTIONS]; // The source and destination sides of each raw transaction, in the same order.
+
+  Description descriptions[MAX_DESCRIPTIONS];
+  int         description_count;
+  int         description_table[DESCRIPTION_TABLE_SIZE];
+
+  Trigram trigrams[TRIGRAM_TABLE_SIZE];
+  int     trigram_count;
+  bool    trigram_overflow; // Too many trigrams, searches scan every description.
+
+  bool   opening_present;            // Loaded from a checkpoint, see CASH_SINCE.
+  Date   opening_date;               // Transactions up to this date are summed in the opening balances.
+  double opening_sums[MAX_ACCOUNTS]; // Balances at the end of the opening date, zero without a checkpoint.
+
+  // The fields above are the parsed content, which every parse starts from zero. The ones below are kept.
+  char  path[PATH_MAX];
+  Arena arena;    // Parse data and appended entries. Descriptions point into the mapped journal file or into the arena.
+  int generation; // Incremented every time the journal is parsed, such that derived indices know when to rebuild.
+
+  char*  mapping; // The journal file, mapped while the journal is open. Descriptions point into it.
+  size_t mapping_size;
+
+  // The part of the journal file that the journal matches, such that appends by other programs can be parsed alone. The last bytes are
+  // kept to check that the parsed part is unchanged.
+  ino_t  parsed_inode;
+  size_t parsed_size;
+  struct timespec parsed_time;
+  char   parsed_tail[PARSED_TAIL_SIZE];
+  int    parsed_tail_size;
+  char*  checkpoint_entry; // The checkpoint the journal is loaded from, transactions before it are summed in its balances.
+  long   archived_size;    // Start of the file with transactions up to the archived date that are in the archive already.
+  Date   archived_date;
+
+  Archive*     archive;
+  Indices*     indices;
+  Balances*    balances;
+  ResultCache* results;
+  BitmapCache* bitmaps;
 };
 
-extern Journal journal;
 typedef Transaction* (*GetFirstTransaction)(Transaction*, Transaction*);
 
-void journal_parse();
-void journal_sort_transactions(Transaction** transactions, int count, GetFirstTransaction get_first, bool reverse);
-void journal_append_transaction(Transaction* transaction);
-Account* get_account(char* name);
+Journal* journal_open(const char* path);
+void journal_free(Journal* journal);
+void journal_parse(Journal* journal);
+bool journal_is_stale(Journal* journal);
+void journal_reload(Journal* journal);
+void journal_sort_transactions(Transaction** transactions, int count, Transaction** buffer, GetFirstTransaction get_first, bool reverse);
+void journal_append_transaction(Journal* journal, Transaction* transaction, char* description);
+int  journal_lock(Journal* journal);
+void journal_unlock(int file);
+void journal_append_checkpoint(Journal* journal, int file, Date* date, double* sums);
+void journal_add_entries(Journal* journal, char* text);
+void journal_parse_transaction(Journal* journal, char** cursor, Transaction* transaction, char** description, int* description_length);
+Account* get_account(Journal* journal, char* name);
 
 #endif
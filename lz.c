@@ -0,0 +1,128 @@
+#include "lz.h"
+#include <string.h>
+
+// Byte oriented LZ77, in the style of LZ4. The data is a list of sequences, each a token with the literal count in the high nibble and
+// the match length minus MIN_MATCH in the low nibble, then the literals, then a two byte offset back to the match. A nibble of 15 is
+// extended by the following bytes, up to and including the first byte that is not 255. The last sequence has only literals.
+
+#define MIN_MATCH  4
+#define MAX_OFFSET 0xffff
+#define HASH_BITS  12
+
+static u32 read_u32(u8* data) {
+  u32 value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static u32 hash(u32 value) {
+  return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static u8* write_length(u8* dest, int length) {
+  for (length -= 15; length >= 255; length -= 255) *dest++ = 255;
+  *dest++ = length;
+  return dest;
+}
+
+// Worst case size of the compressed data, which is all literals.
+int lz_bound(int size) {
+  return size + size / 255 + 16;
+}
+
+// Returns the compressed size, or -1 if the capacity is too small.
+int lz_compress(u8* source, int size, u8* dest, int capacity) {
+  if (capacity < lz_bound(size)) return -1;
+
+  int table[1 << HASH_BITS];
+  memset(table, -1, sizeof(table));
+
+  u8* out = dest;
+  int literal_start = 0;
+  int i = 0;
+
+  while (i + MIN_MATCH <= size) {
+    u32 value = read_u32(&source[i]);
+    u32 h = hash(value);
+    int candidate = table[h];
+    table[h] = i;
+
+    if (candidate < 0 || i - candidate > MAX_OFFSET || read_u32(&source[candidate]) != value) {
+      i++;
+      continue;
+    }
+
+    int length = MIN_MATCH;
+    while (i + length < size && source[candidate + length] == source[i + length]) length++;
+
+    int literals = i - literal_start;
+    int match = length - MIN_MATCH;
+    *out++ = (min(literals, 15) << 4) | min(match, 15);
+    if (literals >= 15) out = write_length(out, literals);
+    memcpy(out, &source[literal_start], literals);
+    out += literals;
+
+    int offset = i - candidate;
+    *out++ = offset & 0xff;
+    *out++ = offset >> 8;
+    if (match >= 15) out = write_length(out, match);
+
+    i += length;
+    literal_start = i;
+  }
+
+  int literals = size - literal_start;
+  *out++ = min(literals, 15) << 4;
+  if (literals >= 15) out = write_length(out, literals);
+  memcpy(out, &source[literal_start], literals);
+  out += literals;
+
+  return out - dest;
+}
+
+static bool read_length(u8** cursor, u8* end, int* length) {
+  if (*length != 15) return true;
+
+  while (true) {
+    if (*cursor == end) return false;
+    u8 byte = *(*cursor)++;
+    *length += byte;
+    if (byte != 255) return true;
+  }
+}
+
+// Returns false if the data is corrupt or does not decompress to exactly raw_size bytes.
+bool lz_decompress(u8* source, int size, u8* dest, int raw_size) {
+  u8* cursor = source;
+  u8* end = source + size;
+  int written = 0;
+
+  while (cursor < end) {
+    u8 token = *cursor++;
+
+    int literals = token >> 4;
+    if (!read_length(&cursor, end, &literals)) return false;
+    if (literals > end - cursor || literals > raw_size - written) return false;
+
+    memcpy(&dest[written], cursor, literals);
+    cursor += literals;
+    written += literals;
+
+    if (cursor == end) break;
+    if (end - cursor < 2) return false;
+
+    int offset = cursor[0] | (cursor[1] << 8);
+    cursor += 2;
+
+    int length = token & 15;
+    if (!read_length(&cursor, end, &length)) return false;
+    length += MIN_MATCH;
+
+    if (offset == 0 || offset > written || length > raw_size - written) return false;
+
+    // The match can overlap the bytes it writes, so it is copied byte by byte.
+    for (int i = 0; i < length; i++, written++) dest[written] = dest[written - offset];
+  }
+
+  return written == raw_size;
+}
@@ -0,0 +1,11 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include "basic.h"
+#include <stdbool.h>
+
+int  lz_bound(int size);
+int  lz_compress(u8* source, int size, u8* dest, int capacity);
+bool lz_decompress(u8* source, int size, u8* dest, int raw_size);
+
+#endif
@@ -8,21 +8,85 @@
 #include "add.h"
 #include <stdio.h>
 #include "history.h"
+#include "trace.h"
+#include "command.h"
+#include "speculation.h"
+#include "watch.h"
+#include "server.h"
+#include "cash.h"
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
 
-int main() {
-  journal_parse();
+static char* journal_path = JOURNAL_PATH;
+static Query* session; // Of the terminal session.
+
+static volatile sig_atomic_t interrupted;
+
+// Also cancels the command that is executing in the foreground. A speculative one is stopped before leaving.
+static void handle_interrupt(int signal) {
+  interrupted = 1;
+  if (session) session->cancelled = 1;
+}
+
+static void exit_unreadable() {
+  fprintf(stderr, "Can not read the journal %s\n", journal_path);
+  exit(1);
+}
+
+// With arguments, the journal is served to clients with -daemon, or the arguments are a command that is executed without a session.
+int main(int argument_count, char** arguments) {
+  trace_init();
+
+  if (argument_count > 1 && !strcmp(arguments[1], "-daemon")) {
+    CashJournal* journal = cash_open(journal_path);
+    if (!journal) exit_unreadable();
+    server_run(journal, journal_path);
+    cash_close(journal);
+    return 0;
+  }
+
+  if (argument_count > 1) {
+    char command[INPUT_SIZE] = "";
+    for (int i = 1; i < argument_count; i++) {
+      if (i > 1) strncat(command, " ", sizeof(command) - strlen(command) - 1);
+      strncat(command, arguments[i], sizeof(command) - strlen(command) - 1);
+    }
+
+    client_run(journal_path, command);
+    return 0;
+  }
+
+  signal(SIGINT, handle_interrupt); // Leave through exit such that the terminal is reset and the trace is written.
+
+  // The session uses the engine directly, on its own journal and query context.
+  Journal* journal = journal_open(journal_path);
+  if (!journal) exit_unreadable();
+  session = query_create(journal);
 
   terminal_init();
   load_history_from_file();
+  command_line_init(session);
   command_line_handle(KEYCODE_NONE);
 
-  while (1) {
+  watch_init(journal_path);
+
+  while (!interrupted) {
     int keycode = get_input_keycode();
     if (keycode == KEYCODE_CTRL_C) break;
-    if (keycode == KEYCODE_NONE) continue;
+
+    // Changes to the journal by other programs are picked up when no input is waiting.
+    if (keycode == KEYCODE_NONE) {
+      command_line_idle();
+      continue;
+    }
     
     command_line_handle(keycode);
   }
 
+  speculation_stop();
+  query_free(session);
+  session = 0;
+  journal_free(journal);
   return 0;
 }
@@ -0,0 +1,280 @@
+#include "optimizer.h"
+#include "journal.h"
+#include "basic.h"
+
+// Rewrites the parsed filter such that apply_filter does as little work as possible. Chains of and/or are flattened, account predicates
+// implied by another predicate in the chain are removed, adjacent account ranges of an or chain are merged, and the remaining operands are
+// ordered by estimated cost and selectivity, which are based on the journal statistics. apply_filter short circuits and/or, so cheap and
+// decisive operands are evaluated first.
+
+#define MAX_TERMS 64
+
+typedef struct {
+  double cost;        // Roughly the number of comparisons and memory accesses per transaction.
+  double selectivity; // Estimated fraction of transactions for which the filter is true.
+} Estimate;
+
+static bool is_logical(Filter* filter, int type) {
+  return (filter->type == FILTER_BINARY) && (filter->binary.type == type);
+}
+
+static bool is_account_filter(Filter* filter) {
+  if (filter->type != FILTER_PRIMARY) return false;
+  int type = filter->primary.type;
+  return (type == PRIMARY_FROM) || (type == PRIMARY_TO) || (type == PRIMARY_ACCOUNT);
+}
+
+static double get_account_selectivity(Journal* journal, PrimaryFilter* primary) {
+  int from_count = 0;
+  int to_count   = 0;
+
+  for (int i = primary->index; i < primary->index + primary->count; i++) {
+    from_count += journal->accounts[i].from_count;
+    to_count   += journal->accounts[i].to_count;
+  }
+
+  double total = max(journal->raw_transaction_count, 1);
+
+  switch (primary->type) {
+    case PRIMARY_FROM: return from_count / total;
+    case PRIMARY_TO:   return to_count / total;
+    default:           return min(1.0, (from_count + to_count) / total);
+  }
+}
+
+static double get_description_selectivity(Journal* journal, PrimaryFilter* primary) {
+  int count = 0;
+
+  for (int i = 1; i < journal->description_count; i++) {
+    if (primary->matches[i]) count += journal->descriptions[i].count;
+  }
+
+  return count / (double)max(journal->raw_transaction_count, 1);
+}
+
+static Estimate estimate(Journal* journal, Filter* filter) {
+  switch (filter->type) {
+    case FILTER_PRIMARY: {
+      PrimaryFilter* primary = &filter->primary;
+
+      switch (primary->type) {
+        case PRIMARY_FROM:
+        case PRIMARY_TO:
+          return (Estimate){ 1, get_account_selectivity(journal, primary) };
+        case PRIMARY_ACCOUNT:
+          return (Estimate){ 2, get_account_selectivity(journal, primary) };
+        case PRIMARY_DESCRIPTION:
+        case PRIMARY_DESCRIPTION_REGEX:
+          return (Estimate){ 2, get_description_selectivity(journal, primary) };
+        case PRIMARY_WEEKDAY:
+          return (Estimate){ 8, 6.0 / 7.0 };
+        case PRIMARY_NUMBER:
+        case PRIMARY_DAY_NUMBER:
+          return (Estimate){ 0, primary->number != 0 };
+        case PRIMARY_REF_PRESENT:
+          return (Estimate){ 1, 0.5 };
+        default:
+          return (Estimate){ 1, 0.9 };
+      }
+    }
+
+    case FILTER_UNARY: {
+      Estimate inner = estimate(journal, filter->unary.filter);
+      return (Estimate){ inner.cost + 1, 1 - inner.selectivity };
+    }
+
+    case FILTER_BINARY: {
+      Estimate x = estimate(journal, filter->binary.left);
+      Estimate y = estimate(journal, filter->binary.right);
+
+      // Short circuited, the right side is only evaluated when the left side does not decide the result.
+      switch (filter->binary.type) {
+        case BINARY_AND:
+          return (Estimate){ x.cost + x.selectivity * y.cost, x.selectivity * y.selectivity };
+        case BINARY_OR:
+          return (Estimate){ x.cost + (1 - x.selectivity) * y.cost, x.selectivity + y.selectivity - x.selectivity * y.selectivity };
+        case BINARY_EQUAL:
+          return (Estimate){ x.cost + y.cost + 1, 0.1 };
+        case BINARY_NOT_EQUAL:
+          return (Estimate){ x.cost + y.cost + 1, 0.9 };
+        case BINARY_LESS_THAN:
+        case BINARY_LESS_EQUAL:
+        case BINARY_GREATER_THAN:
+        case BINARY_GREATER_EQUAL:
+          return (Estimate){ x.cost + y.cost + 1, 1.0 / 3.0 };
+        default:
+          return (Estimate){ x.cost + y.cost + 1, 0.9 };
+      }
+    }
+  }
+
+  return (Estimate){ 1, 0.5 };
+}
+
+// Lower ranks are evaluated first. For and, cheap operands that are often false go first, for or, cheap operands that are often true.
+static double get_rank(Journal* journal, Filter* filter, int type) {
+  Estimate e = estimate(journal, filter);
+  double decisive = (type == BINARY_AND) ? 1 - e.selectivity : e.selectivity;
+  if (decisive <= 0) return 1e300;
+  return e.cost / decisive;
+}
+
+// True if the account filter x being true means that y is true.
+static bool implies(Filter* x, Filter* y) {
+  PrimaryFilter* a = &x->primary;
+  PrimaryFilter* b = &y->primary;
+
+  bool nested = (b->index <= a->index) && (a->index + a->count <= b->index + b->count);
+  return nested && (a->type == b->type || b->type == PRIMARY_ACCOUNT);
+}
+
+static bool same_range(Filter* x, Filter* y) {
+  return (x->primary.index == y->primary.index) && (x->primary.count == y->primary.count);
+}
+
+// The ranges of x and y are next to each other in account order, like sibling accounts that follow each other.
+static bool is_adjacent(Filter* x, Filter* y) {
+  return x->primary.type == y->primary.type && x->primary.index + x->primary.count == y->primary.index;
+}
+
+static void remove_term(Filter** terms, int* count, int index) {
+  for (int i = index; i < *count - 1; i++) terms[i] = terms[i + 1];
+  *count -= 1;
+}
+
+// Removes account filters that are implied by (and) or imply (or) another account filter in the chain, turns from X or to X into
+// account X, and merges from X or from Y into one range when Y follows X in account order.
+static bool merge_account_filters(Filter** terms, int* count, int type) {
+  bool modified = false;
+  bool merged = true;
+
+  while (merged) {
+    merged = false;
+
+    for (int i = 0; i < *count && !merged; i++) {
+      for (int j = 0; j < *count && !merged; j++) {
+        Filter* x = terms[i];
+        Filter* y = terms[j];
+
+        if (i == j || !is_account_filter(x) || !is_account_filter(y)) continue;
+
+        if (implies(x, y)) {
+          remove_term(terms, count, (type == BINARY_AND) ? j : i);
+          merged = true;
+        } else if (type == BINARY_OR && same_range(x, y) && x->primary.type == PRIMARY_FROM && y->primary.type == PRIMARY_TO) {
+          x->primary.type = PRIMARY_ACCOUNT;
+          remove_term(terms, count, j);
+          merged = true;
+        } else if (type == BINARY_OR && is_adjacent(x, y)) {
+          x->primary.count += y->primary.count;
+          remove_term(terms, count, j);
+          merged = true;
+        }
+      }
+    }
+
+    modified |= merged;
+  }
+
+  return modified;
+}
+
+// Collects the operands of a chain of the same logical operator. Parenthesized sub chains are kept as they are, except for the root.
+static bool collect_terms(Filter* filter, int type, bool root, Filter** terms, int* term_count, Filter** nodes, int* node_count) {
+  if (is_logical(filter, type) && (root || !filter->parenthesized)) {
+    nodes[(*node_count)++] = filter;
+    return collect_terms(filter->binary.left,  type, false, terms, term_count, nodes, node_count) &&
+           collect_terms(filter->binary.right, type, false, terms, term_count, nodes, node_count);
+  }
+
+  if (*term_count == MAX_TERMS) return false;
+  terms[(*term_count)++] = filter;
+  return true;
+}
+
+static bool optimize_chain(Journal* journal, Filter** filter) {
+  Filter* root = *filter;
+  int type = root->binary.type;
+  bool parenthesized = root->parenthesized;
+
+  Filter* terms[MAX_TERMS];
+  Filter* nodes[MAX_TERMS];
+  int term_count = 0;
+  int node_count = 0;
+
+  bool modified = false;
+
+  if (!collect_terms(root, type, true, terms, &term_count, nodes, &node_count)) {
+    modified |= optimize_filter(journal, &root->binary.left);
+    modified |= optimize_filter(journal, &root->binary.right);
+    return modified;
+  }
+
+  for (int i = 0; i < term_count; i++) modified |= optimize_filter(journal, &terms[i]);
+
+  modified |= merge_account_filters(terms, &term_count, type);
+
+  double ranks[MAX_TERMS];
+  for (int i = 0; i < term_count; i++) ranks[i] = get_rank(journal, terms[i], type);
+
+  // Stable insertion sort, such that equally ranked operands keep the order written by the user.
+  for (int i = 1; i < term_count; i++) {
+    Filter* term = terms[i];
+    double rank = ranks[i];
+    int j = i - 1;
+
+    while (j >= 0 && ranks[j] > rank) {
+      terms[j + 1] = terms[j];
+      ranks[j + 1] = ranks[j];
+      j--;
+    }
+
+    if (j + 1 != i) modified = true;
+
+    terms[j + 1] = term;
+    ranks[j + 1] = rank;
+  }
+
+  if (term_count == 1) {
+    terms[0]->parenthesized |= parenthesized;
+    *filter = terms[0];
+    return true;
+  }
+
+  // Rebuild the chain left to right, reusing the binary nodes.
+  Filter* chain = terms[0];
+
+  for (int i = 1; i < term_count; i++) {
+    Filter* node = nodes[i - 1];
+    node->binary.left  = chain;
+    node->binary.right = terms[i];
+    node->parenthesized = false;
+    chain = node;
+  }
+
+  chain->parenthesized = parenthesized;
+  *filter = chain;
+  return modified;
+}
+
+// Returns true if the filter was rewritten.
+bool optimize_filter(Journal* journal, Filter** filter) {
+  Filter* f = *filter;
+  if (!f) return false;
+
+  switch (f->type) {
+    case FILTER_UNARY:
+      return optimize_filter(journal, &f->unary.filter);
+    case FILTER_BINARY:
+      if (is_logical(f, BINARY_AND) || is_logical(f, BINARY_OR)) return optimize_chain(journal, filter);
+      return optimize_filter(journal, &f->binary.left) | optimize_filter(journal, &f->binary.right);
+  }
+
+  return false;
+}
+
+// Estimated fraction of the transactions that the filter keeps.
+double estimate_selectivity(Journal* journal, Filter* filter) {
+  if (!filter) return 1;
+  return limit(estimate(journal, filter).selectivity, 0.0, 1.0);
+}
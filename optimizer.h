@@ -0,0 +1,9 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "command.h"
+
+bool   optimize_filter(Journal* journal, Filter** filter);
+double estimate_selectivity(Journal* journal, Filter* filter);
+
+#endif
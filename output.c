@@ -0,0 +1,97 @@
+#include "output.h"
+#include "stats.h"
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define OUTPUT_BUFFER_SIZE (4096 * 4096 * 16)
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+static int  output_size;
+static pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER; // Threads without a capture share the buffer.
+
+static __thread Capture* capture; // Output of this thread goes to the capture instead of the terminal.
+
+static int print_captured(const char* text, va_list arguments) {
+  if (capture->size + 4000 > capture->capacity) {
+    capture->overflow = true;
+    return 0;
+  }
+
+  int size = vsnprintf(&capture->data[capture->size], capture->capacity - capture->size, text, arguments);
+  capture->size += size;
+  return size;
+}
+
+static void write_buffer() {
+  assert(write(STDOUT_FILENO, output_buffer, output_size) == output_size);
+  stats_add_bytes(output_size);
+  output_size = 0;
+}
+
+int print(const char* text, ...) {
+  va_list arguments;
+  va_start(arguments, text);
+
+  if (capture) {
+    int size = print_captured(text, arguments);
+    va_end(arguments);
+    return size;
+  }
+
+  pthread_mutex_lock(&output_mutex);
+  if (output_size + 4000 > OUTPUT_BUFFER_SIZE) {
+    write_buffer();
+  }
+  int size = vsnprintf(&output_buffer[output_size], OUTPUT_BUFFER_SIZE - output_size, text, arguments);
+  va_end(arguments);
+  output_size += size;
+  pthread_mutex_unlock(&output_mutex);
+  return size;
+}
+
+void flush() {
+  // Captured output is kept, but counted as written when the capturing thread flushes it.
+  if (capture) {
+    stats_add_bytes(capture->size - capture->flushed);
+    capture->flushed = capture->size;
+    return;
+  }
+
+  pthread_mutex_lock(&output_mutex);
+  write_buffer();
+  pthread_mutex_unlock(&output_mutex);
+}
+
+void capture_output(Capture* target) {
+  capture = target;
+  if (target) {
+    target->size = 0;
+    target->flushed = 0;
+    target->overflow = false;
+  }
+}
+
+void write_capture(Capture* source) {
+  flush();
+
+  for (int written = 0; written < source->size;) {
+    int size = write(STDOUT_FILENO, &source->data[written], source->size - written);
+    assert(size > 0);
+    written += size;
+  }
+}
+
+static __thread int screen_height, screen_width;
+
+// Set by the terminal when it is resized. Without a terminal the layout is made for the screen of a client. Each thread lays out its
+// output for its own screen size.
+void set_size(int width, int height) {
+  screen_width  = width;
+  screen_height = height;
+}
+
+void get_size(int* width, int* height) {
+  *width  = screen_width;
+  *height = screen_height;
+}
@@ -0,0 +1,45 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "basic.h"
+#include <stdbool.h>
+
+// Output of a thread that is kept in memory instead of written to the terminal.
+typedef struct {
+  char* data;
+  int size;
+  int capacity;
+  int flushed;
+  bool overflow; // Output was dropped, the capture is incomplete.
+} Capture;
+
+int  print(const char* text, ...);
+void flush();
+void capture_output(Capture* target);
+void write_capture(Capture* source);
+void get_size(int* width, int* height);
+void set_size(int width, int height);
+
+static inline void bold()                   { print("\033[1m"); }
+static inline void faint()                  { print("\033[2m\033[3m"); }
+static inline void underline()              { print("\033[4m"); }
+static inline void not_bold()               { print("\033[22m"); }
+static inline void clear_all_right()        { print("\033[0J"); }
+static inline void push_cursor()            { print("\033[s"); }
+static inline void pop_cursor()             { print("\033[u"); }
+static inline void cursor_up(int n)         { print("\033[%dA", n); }
+static inline void cursor_down(int n)       { print("\033[%dB", n); }
+static inline void cursor_right(int n)      { print("\033[%dC", n); }
+static inline void cursor_left(int n)       { print("\033[%dD", n); }
+static inline void clear_to_right()         { print("\033[K"); }
+static inline void clear_line()             { print("\033[2K"); }
+static inline void cursor_style_line()      { print("\033[5 q"); }
+static inline void format_off()             { print("\033[0m"); }
+static inline void hide_cursor()            { print("\033[?25l"); }
+static inline void show_cursor()            { print("\033[?25h"); }
+static inline void clear_all()              { print("\033[2J"); }
+static inline void invert()                 { print("\033[7m"); }
+static inline void set_x_cursor(int x)      { print("\033[%dG", x + 1); }
+static inline void set_cursor(int x, int y) { print("\033[%d;%dH", y + 1, x + 1); }
+
+#endif
@@ -0,0 +1,950 @@
+#define _GNU_SOURCE
+
+#include "parser.h"
+#include "output.h"
+#include "text.h"
+#include "journal.h"
+#include "date.h"
+#include "arena.h"
+#include "description.h"
+#include "regex.h"
+#include "optimizer.h"
+#include "group.h"
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <stdarg.h>
+
+static Filter* parse_filter(Query* query, char** cursor);
+
+const char* binop[] = {
+  "#",
+  "=",
+  "<",
+  ">",
+  "<=",
+  ">=",
+  "!=",
+  "or",
+  "and",
+  "*",
+  "/",
+  "+",
+  "-",
+};
+
+static void arena_clear(Query* query) {
+    query->arena_index = 0;
+    memset(query->arena, 0, FILTER_ARENA_SIZE);
+    arena_reset(&query->filter_data);
+}
+
+static void* arena_allocate(Query* query, int size) {
+    void* pointer = &query->arena[query->arena_index];
+    query->arena_index += size;
+    return pointer;
+}
+
+static void* new_filter(Query* query, int type) {
+    Filter* filter = arena_allocate(query, sizeof(Filter));
+    filter->type = type;
+    return filter;
+}
+
+static char* get_string_arena(Query* query, char** cursor) { // Hack because injecting 0 would corrupt the data.
+  int size;
+  char* data = get_string_size(cursor, &size);
+  char* buffer = arena_allocate(query, size + 1);
+  memcpy(buffer, data, size);
+  buffer[size] = 0;
+  return buffer;
+}
+
+// Evaluates a description filter once per unique description instead of once per transaction.
+static bool* match_descriptions(Query* query, char* pattern) {
+  int count = query->journal->description_count;
+  bool* matches = arena_push(&query->filter_data, max(count, 1) * sizeof(bool));
+  int* ids = arena_push(&query->filter_data, max(count, 1) * sizeof(int));
+
+  memset(matches, 0, max(count, 1) * sizeof(bool));
+
+  int match_count = search_descriptions(query->journal, pattern, ids);
+  for (int i = 0; i < match_count; i++) matches[ids[i]] = true;
+
+  return matches;
+}
+
+// The regular expression is compiled once per query and matched against every unique description.
+static bool* match_descriptions_regex(Query* query, char* pattern) {
+  Regex* regex = regex_compile(pattern, &query->filter_data);
+  if (!regex) return 0;
+
+  int count = query->journal->description_count;
+  bool* matches = arena_push(&query->filter_data, max(count, 1) * sizeof(bool));
+  matches[0] = false;
+
+  for (int i = 1; i < count; i++) {
+    Description* description = &query->journal->descriptions[i];
+    matches[i] = regex_match(regex, description->string, description->length);
+  }
+
+  return matches;
+}
+
+// Evaluates the description filters again for descriptions that were added to the journal after the filter was parsed.
+void update_description_matches(Query* query, Filter* filter) {
+  if (!filter) return;
+
+  if (filter->type == FILTER_UNARY) {
+    update_description_matches(query, filter->unary.filter);
+  } else if (filter->type == FILTER_BINARY) {
+    update_description_matches(query, filter->binary.left);
+    update_description_matches(query, filter->binary.right);
+  } else if (filter->primary.type == PRIMARY_DESCRIPTION) {
+    filter->primary.matches = match_descriptions(query, filter->primary.string);
+  } else if (filter->primary.type == PRIMARY_DESCRIPTION_REGEX) {
+    filter->primary.matches = match_descriptions_regex(query, filter->primary.string);
+  }
+}
+
+static void* parse_filter_primary(Query* query, char** cursor) {
+  PrimaryFilter* primary = new_filter(query, FILTER_PRIMARY);
+  bool fill_account_info = 0;
+
+  if (skip_string(cursor, "from")) {
+    primary->type = PRIMARY_FROM;
+    fill_account_info = true;
+  } else if (skip_string(cursor, "to")) {
+    primary->type = PRIMARY_TO;
+    fill_account_info = true;
+  } else if (skip_string(cursor, "account")) {
+    primary->type = PRIMARY_ACCOUNT;
+    fill_account_info = true;
+  } else if (skip_string(cursor, "amount")) {
+    primary->type = PRIMARY_AMOUNT;
+  } else if (skip_string(cursor, "desc")) {
+    primary->type = skip_char(cursor, '~') ? PRIMARY_DESCRIPTION_REGEX : PRIMARY_DESCRIPTION;
+    char* data = get_quoted_string(cursor);
+    if (!data) {
+      query->error_message = (primary->type == PRIMARY_DESCRIPTION) ? "expecting a quoted description" : "expecting a quoted regular expression";
+      return 0;
+    }
+    primary->string = arena_push_string(&query->filter_data, data, strlen(data));
+
+    if (primary->type == PRIMARY_DESCRIPTION) {
+      primary->matches = match_descriptions(query, primary->string);
+    } else {
+      primary->matches = match_descriptions_regex(query, primary->string);
+      if (!primary->matches) {
+        query->error_message = "invalid regular expression";
+        return 0;
+      }
+    }
+  } else if (skip_string(cursor, "day")) {
+      primary->type = PRIMARY_DAY;
+  } else if (skip_string(cursor, "month")) {
+    primary->type = PRIMARY_MONTH;
+  } else if (skip_string(cursor, "year")) {
+    primary->type = PRIMARY_YEAR;
+  } else if (skip_string(cursor, "ref")) {
+    primary->type = PRIMARY_REF_PRESENT;
+  } else {
+    skip_blank(cursor);
+
+    if (is_letter(**cursor)) {
+      char* text = get_string_arena(query, cursor);
+      int day = get_day(text);
+      if (day > 0) {
+        primary->type = PRIMARY_DAY_NUMBER;
+        primary->number = day;
+      } else {
+        int month = get_month(text);
+        if (month == 0) {
+          query->error_message = "expecting a day or month name";
+          return 0;
+        }
+      }
+    } else if (is_number(**cursor) || (**cursor == '-' && is_number(*(*cursor + 1)))) {
+      primary->type = PRIMARY_NUMBER;
+      primary->number = get_double(cursor);
+    } else {
+      query->error_message = "expecting a number";
+      return 0;
+    }
+  }
+
+  if (fill_account_info) {
+    char* data = get_string_arena(query, cursor);    
+    Account* node = get_account(query->journal, data);
+
+    if (!node) {
+      query->error_message = "invalid account";
+      return 0;
+    }
+
+    primary->string = data;
+    primary->index  = node->index;
+    primary->count  = node->count;
+  }
+
+  return primary;
+}
+
+static void* parse_filter_unary(Query* query, char** cursor) {
+  if (skip_string(cursor, "not")) {
+    UnaryFilter* unary = new_filter(query, FILTER_UNARY);
+    unary->type = UNARY_NOT;
+    unary->filter = parse_filter_unary(query, cursor);
+    if (unary->filter == 0) return 0;
+    return unary;
+  } else if (skip_char(cursor, '(')) {
+    Filter* filter = parse_filter(query, cursor);
+    if (!skip_char(cursor, ')')) {
+      query->error_message = "expecting closing parenthesis";
+      return 0;
+    }
+    if (filter) filter->parenthesized = true;
+    return filter;
+  } else {
+    return parse_filter_primary(query, cursor);
+  }
+}
+
+static int get_binary_type(char** cursor) {
+       if (skip_string(cursor, "and")) return BINARY_AND;
+  else if (skip_string(cursor, "or" )) return BINARY_OR;
+  else if (skip_string(cursor, "!=" )) return BINARY_NOT_EQUAL;
+  else if (skip_string(cursor, ">=" )) return BINARY_GREATER_EQUAL;
+  else if (skip_string(cursor, "<=" )) return BINARY_LESS_EQUAL;
+  else if (skip_string(cursor, "="  )) return BINARY_EQUAL;
+  else if (skip_string(cursor, "<"  )) return BINARY_LESS_THAN;
+  else if (skip_string(cursor, ">"  )) return BINARY_GREATER_THAN;
+  else if (skip_string(cursor, "*"  )) return BINARY_MULTIPLY;
+  else if (skip_string(cursor, "/"  )) return BINARY_DIVIDE;
+  else if (skip_string(cursor, "+"  )) return BINARY_PLUS;
+  else if (skip_string(cursor, "- "  )) return BINARY_MINUS; // Hack for multiple filters.
+  else                                 return BINARY_NONE;
+}
+
+static int get_precedence(int type) {
+  switch (type) {
+    case BINARY_MULTIPLY:
+    case BINARY_DIVIDE:
+      return 6;
+    case BINARY_PLUS:
+    case BINARY_MINUS:
+      return 5;
+    case BINARY_EQUAL:
+    case BINARY_NOT_EQUAL:
+      return 4;
+    case BINARY_LESS_THAN:
+    case BINARY_LESS_EQUAL:
+    case BINARY_GREATER_THAN:
+    case BINARY_GREATER_EQUAL:
+      return 3;
+    case BINARY_AND:
+      return 2;
+    case BINARY_OR:
+      return 1;
+    default:
+      return 0;
+  }
+} 
+
+static bool filter_is_number(Filter* filter) {
+  return (filter->type == FILTER_PRIMARY) && (filter->primary.type == PRIMARY_NUMBER);
+}
+
+static bool filter_is_day_number(Filter* filter) {
+  return (filter->type == FILTER_PRIMARY) && (filter->primary.type == PRIMARY_DAY_NUMBER);
+}
+
+static bool filter_is_day(Filter* filter) {
+  return (filter->type == FILTER_PRIMARY) && (filter->primary.type == PRIMARY_DAY);
+}
+
+static bool filter_is_ref_present(Filter* filter) {
+  return (filter->type == FILTER_PRIMARY) && (filter->primary.type == PRIMARY_REF_PRESENT);
+}
+
+static Filter* parse_filter_recursive(Query* query, char** cursor, int previous_precedence) {
+  Filter* left = parse_filter_unary(query, cursor);
+  if (!left) return 0;
+
+  while (true) {
+    char* saved_cursor = *cursor;
+
+    int type = get_binary_type(cursor);
+    int precedence = get_precedence(type);
+
+    if (precedence <= previous_precedence || precedence == 0) {
+      *cursor = saved_cursor;
+      return left;
+    }
+
+    Filter* right = parse_filter_recursive(query, cursor, precedence);
+    if (!right) return 0;
+
+    // Determine if we can evaluate a constant expression.
+    bool left_is_number      = filter_is_number(left);
+    bool left_is_day_number  = filter_is_day_number(left);
+    bool left_is_const       = left_is_number  || left_is_day_number; 
+
+    bool right_is_number     = filter_is_number(right);
+    bool right_is_day_number = filter_is_day_number(right);
+    bool right_is_const      = right_is_number || right_is_day_number; 
+
+    if (filter_is_day(left) && right_is_day_number) {
+      left->primary.type = PRIMARY_WEEKDAY;
+    }
+
+    if (filter_is_ref_present(left) && right_is_const) {
+      left->primary.type = PRIMARY_REF_SEARCH;
+    }
+
+    if (left_is_const && right_is_const) {
+      double x = left->primary.number;
+      double y = right->primary.number;
+      double r;
+
+      switch (type) {
+        case BINARY_EQUAL:         r = x == y; break;
+        case BINARY_LESS_THAN:     r = x <  y; break;
+        case BINARY_GREATER_THAN:  r = x >  y; break;
+        case BINARY_LESS_EQUAL:    r = x <= y; break;
+        case BINARY_GREATER_EQUAL: r = x >= y; break;
+        case BINARY_NOT_EQUAL:     r = x != y; break;
+        case BINARY_OR:            r = x || y; break;
+        case BINARY_AND:           r = x && y; break;
+        case BINARY_MULTIPLY:      r = x *  y; break;
+        case BINARY_DIVIDE:        r = x /  y; break;
+        case BINARY_PLUS:          r = x +  y; break;
+        case BINARY_MINUS:         r = x -  y; break;
+        default: assert(0);
+      }
+
+      query->options.filter_modified = true;
+      
+      left->type = FILTER_PRIMARY;
+      left->primary.number = r;
+
+      if (left_is_day_number || right_is_day_number) {
+        left->primary.type = PRIMARY_DAY_NUMBER;
+      } else {
+        left->primary.type = PRIMARY_NUMBER;
+      }
+    } else {
+      BinaryFilter* binary = new_filter(query, FILTER_BINARY);
+
+      binary->type  = type;
+      binary->left  = left;
+      binary->right = right;
+
+      left = (Filter*)binary;
+    }
+  }
+}
+
+static Filter* parse_filter(Query* query, char** cursor) {
+  skip_blank(cursor);
+  if (**cursor == 0) return 0;
+  return parse_filter_recursive(query, cursor, -1);
+}
+
+static void append(char* buffer, int capacity, const char* format, ...) {
+  int length = strlen(buffer);
+  if (length >= capacity - 1) return;
+
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer + length, capacity - length, format, args);
+  va_end(args);
+}
+
+// An account range merged by the optimizer is written as its first and last account.
+static void append_account(Journal* journal, char* buffer, int capacity, char* name, PrimaryFilter* primary) {
+  Account* last = &journal->accounts[primary->index + primary->count - 1];
+
+  if (primary->count > journal->accounts[primary->index].count) {
+    append(buffer, capacity, "%s %s..%s ", name, primary->string, last->path);
+  } else {
+    append(buffer, capacity, "%s %s ", name, primary->string);
+  }
+}
+
+// Writes the filter the same way as the user wrote it, with all constant expressions evaluated. Exact numbers are used for cache keys,
+// where 10.004 and 10.00 must differ.
+void format_filter(Journal* journal, char* buffer, int capacity, Filter* filter, bool exact) {
+  if (!filter) return;
+
+  if (filter->type == FILTER_PRIMARY) {
+    switch (filter->primary.type) {
+      case PRIMARY_FROM:
+        append_account(journal, buffer, capacity, "from", &filter->primary);
+        break;
+      case PRIMARY_TO:
+        append_account(journal, buffer, capacity, "to", &filter->primary);
+        break;
+      case PRIMARY_ACCOUNT:
+        append_account(journal, buffer, capacity, "account", &filter->primary);
+        break;
+      case PRIMARY_DESCRIPTION:
+        append(buffer, capacity, "desc '%s' ", filter->primary.string);
+        break;
+      case PRIMARY_DESCRIPTION_REGEX:
+        append(buffer, capacity, "desc ~ '%s' ", filter->primary.string);
+        break;
+      case PRIMARY_AMOUNT:
+        append(buffer, capacity, "amount ");
+        break;
+      case PRIMARY_WEEKDAY:
+        append(buffer, capacity, "weekday ");
+        break;
+      case PRIMARY_DAY:
+        append(buffer, capacity, "day ");
+        break;
+      case PRIMARY_MONTH:
+        append(buffer, capacity, "month ");
+        break;
+      case PRIMARY_YEAR:
+        append(buffer, capacity, "year ");
+        break;
+      case PRIMARY_REF_PRESENT:
+      case PRIMARY_REF_SEARCH:
+        append(buffer, capacity, "ref ");
+        break;
+      case PRIMARY_NUMBER:
+        append(buffer, capacity, exact ? "%.17g " : "%.2lf ", filter->primary.number);
+        break;
+      case PRIMARY_DAY_NUMBER: {
+        int n = (int)filter->primary.number;
+        if (1 <= n && n <= 7) {
+          append(buffer, capacity, "%s ", day_names[n - 1]);
+        } else {
+          append(buffer, capacity, "error (%d) ", n);
+        }
+      } break;
+    }
+  } else if (filter->type == FILTER_UNARY) {
+    append(buffer, capacity, "not ");
+    format_filter(journal, buffer, capacity, filter->unary.filter, exact);
+  } else if (filter->type == FILTER_BINARY) {
+    if (filter->parenthesized) append(buffer, capacity, "(");
+    format_filter(journal, buffer, capacity, filter->binary.left, exact);
+    append(buffer, capacity, "%s ", binop[filter->binary.type]);
+    format_filter(journal, buffer, capacity, filter->binary.right, exact);
+    if (filter->parenthesized) append(buffer, capacity, ") ");
+  }
+}
+
+void print_filter(Journal* journal, Filter* filter) {
+  char buffer[2 * INPUT_SIZE] = "";
+  format_filter(journal, buffer, sizeof(buffer), filter, false);
+  print("%s", buffer);
+}
+
+// Evaluates the filter on the transaction seen with the given accounts and amount, which are the posting's for the unified view.
+static double evaluate(Filter* filter, Transaction* transaction, int from, int to, double amount) {
+  switch (filter->type) {
+    case FILTER_BINARY: {
+      Filter* left  = filter->binary.left;
+      Filter* right = filter->binary.right;
+
+      // Short circuit, the optimizer orders the operands such that the left side usually decides.
+      if (filter->binary.type == BINARY_AND) {
+        return evaluate(left, transaction, from, to, amount) && evaluate(right, transaction, from, to, amount);
+      } else if (filter->binary.type == BINARY_OR) {
+        return evaluate(left, transaction, from, to, amount) || evaluate(right, transaction, from, to, amount);
+      }
+
+      double x = evaluate(left,  transaction, from, to, amount);
+      double y = evaluate(right, transaction, from, to, amount);
+      double r;
+
+      switch (filter->binary.type) {
+        case BINARY_EQUAL:         r = x == y; break;
+        case BINARY_LESS_THAN:     r = x <  y; break;
+        case BINARY_GREATER_THAN:  r = x >  y; break;
+        case BINARY_LESS_EQUAL:    r = x <= y; break;
+        case BINARY_GREATER_EQUAL: r = x >= y; break;
+        case BINARY_NOT_EQUAL:     r = x != y; break;
+        case BINARY_OR:            r = x || y; break;
+        case BINARY_AND:           r = x && y; break;
+        case BINARY_MULTIPLY:      r = x *  y; break;
+        case BINARY_DIVIDE:        r = x /  y; break;
+        case BINARY_PLUS:          r = x +  y; break;
+        case BINARY_MINUS:         r = x -  y; break;
+        default: assert(0);
+      }
+
+      return r;
+    }
+
+    case FILTER_PRIMARY: {
+      int type  = filter->primary.type;
+      int start = filter->primary.index;
+      int end   = filter->primary.count + start;
+
+      if (!transaction && type != PRIMARY_NUMBER) return 0;
+
+      switch (type) {
+        case PRIMARY_FROM:
+          return (double)(start <= from && from < end);
+        case PRIMARY_TO:
+          return (double)(start <= to && to < end);
+        case PRIMARY_ACCOUNT:
+          return (double)((start <= from && from < end) || (start <= to && to < end));
+        case PRIMARY_DESCRIPTION:
+        case PRIMARY_DESCRIPTION_REGEX:
+          return (double)(transaction->description && filter->primary.matches[transaction->description]);
+        case PRIMARY_WEEKDAY:
+          return date_to_weekday(transaction->date.day, transaction->date.month, transaction->date.year);
+        case PRIMARY_AMOUNT:
+          return amount;
+        case PRIMARY_DAY:
+          return transaction->date.day;
+        case PRIMARY_MONTH:
+          return transaction->date.month;
+        case PRIMARY_YEAR:
+          return transaction->date.year;
+        case PRIMARY_NUMBER:
+        case PRIMARY_DAY_NUMBER:
+          return filter->primary.number;
+        case PRIMARY_REF_PRESENT:
+          return transaction->reference >= 0;
+        case PRIMARY_REF_SEARCH:
+          return transaction->reference;
+        default:
+          assert(0);
+      }
+
+      return 0;
+    }
+
+    case FILTER_UNARY:
+      assert(filter->unary.type == UNARY_NOT);
+      return (double)!(bool)evaluate(filter->unary.filter, transaction, from, to, amount);
+  }
+
+  assert(0);
+  return 0;
+}
+
+double apply_filter(Filter* filter, Transaction* transaction) {
+  if (!transaction) return evaluate(filter, 0, 0, 0, 0);
+  return evaluate(filter, transaction, transaction->from, transaction->to, transaction->amount);
+}
+
+double apply_filter_posting(Filter* filter, Posting* posting) {
+  return evaluate(filter, posting->transaction, posting->account, posting->counterparty, posting->amount);
+}
+
+// Probably stupid to have a separate evaluator just to hide some accounts in the balance view...
+int apply_filter_account(Filter* filter, Account* node) {
+  switch (filter->type) {
+    case FILTER_BINARY: {
+      Filter* left  = filter->binary.left;
+      Filter* right = filter->binary.right;
+
+      int x = apply_filter_account(left,  node);
+      int y = apply_filter_account(right, node);
+      int r;
+
+      if (x < 0) return y;
+      if (y < 0) return x;
+
+      switch (filter->binary.type) {
+        case BINARY_EQUAL:         r = x == y; break;
+        case BINARY_LESS_THAN:     r = x <  y; break;
+        case BINARY_GREATER_THAN:  r = x >  y; break;
+        case BINARY_LESS_EQUAL:    r = x <= y; break;
+        case BINARY_GREATER_EQUAL: r = x >= y; break;
+        case BINARY_NOT_EQUAL:     r = x != y; break;
+        case BINARY_OR:            r = x || y; break;
+        case BINARY_AND:           r = x && y; break;
+        case BINARY_MULTIPLY:      r = x *  y; break;
+        case BINARY_DIVIDE:        r = x /  y; break;
+        case BINARY_PLUS:          r = x +  y; break;
+        case BINARY_MINUS:         r = x -  y; break;
+        default: assert(0);
+      }
+
+      return r;
+    }
+
+    case FILTER_PRIMARY: {
+      int type  = filter->primary.type;
+      int start = filter->primary.index;
+      int end   = filter->primary.count + start;
+
+      switch (type) {
+        case PRIMARY_FROM:
+        case PRIMARY_TO:
+        case PRIMARY_ACCOUNT:
+          return (start <= node->index) && (node->index < end);
+        case PRIMARY_AMOUNT:
+        case PRIMARY_WEEKDAY:
+        case PRIMARY_DAY:
+        case PRIMARY_DESCRIPTION:
+        case PRIMARY_DESCRIPTION_REGEX:
+        case PRIMARY_MONTH:
+        case PRIMARY_YEAR:
+        case PRIMARY_REF_SEARCH:
+        case PRIMARY_REF_PRESENT:
+        case PRIMARY_NUMBER:
+        case PRIMARY_DAY_NUMBER:
+          return -1;
+        default:
+          assert(0);
+      }
+
+      return 0;
+    }
+
+    case FILTER_UNARY:
+      assert(filter->unary.type == UNARY_NOT);
+      int status = apply_filter_account(filter->unary.filter, node);
+      return (status == -1) ? -1 : !status;
+  }
+
+  assert(0);
+  return 0;
+}
+
+static bool try_parse_date(char** cursor, OptionsDate* date) {
+  char* data = *cursor;
+  skip_blank(&data);
+
+  if (*data == '*') {
+    data++;
+    date->wild = true;
+  } else {
+    int* numbers = &date->day;
+    for (int i = 0; i < 3; i++) {
+      if (i && *data != '.') break;
+      if (*data == '.') data++;
+
+      int n;
+      if (sscanf(data, "%d%n", &numbers[i], &n) == 1) {
+        date->count++;
+        data += n;
+        continue;
+      }
+
+      char* start = data;
+      while (*data && (*data != '.') && (*data != ' ')) data++;
+
+      int size = data - start;
+      if (size != 3) break;
+
+      int month = get_month(start);
+      if (month == 0) break;
+
+      numbers[i] = month;
+      date->count++;
+    }
+  }
+
+  *cursor = data;
+  return date->count || date->wild;
+}
+
+static bool parse_date_option(Query* query, char** cursor) {
+  Command* options = &query->options;
+  if (!try_parse_date(cursor, &options->from)) return false;
+
+  char* saved_cursor = *cursor;
+  if (!try_parse_date(cursor, &options->to)) {
+    *cursor = saved_cursor;
+  }
+
+  options->date_present = true;
+  clean_up_dates(&options->from, &options->to);
+  return true;
+}
+
+// The end of the date, like the end of a -date range.
+static bool parse_at_option(Query* query, char** cursor) {
+  Command* options = &query->options;
+  OptionsDate date = { 0 };
+  OptionsDate end  = { 0 };
+
+  if (!try_parse_date(cursor, &date)) {
+    query->error_message = "expecting a date";
+    return false;
+  }
+
+  clean_up_dates(&date, &end);
+
+  if (end.month < 1 || end.month > 12 || end.day < 1 || end.day > 31) {
+    query->error_message = "invalid date";
+    return false;
+  }
+
+  options->at = end.date;
+  options->at_present = true;
+  return true;
+}
+
+static bool parse_sort_option(Query* query, char** data) {
+  Command* options = &query->options;
+  if (skip_char(data, '!')) options->sort_reverse = true;
+
+         if (skip_string(data, "date")) {
+    options->sort = SORT_DATE;
+  } else if (skip_string(data, "from")) {
+    options->sort = SORT_FROM;
+  } else if (skip_string(data, "to")) {
+    options->sort = SORT_TO;
+  } else if (skip_string(data, "amount")) {
+    options->sort = SORT_AMOUNT;
+  } else if (skip_string(data, "count")) {
+    options->sort = SORT_COUNT;
+  } else if (skip_string(data, "sum")) {
+    options->sort = SORT_SUM;
+  } else if (skip_string(data, "min")) {
+    options->sort = SORT_MIN;
+  } else if (skip_string(data, "max")) {
+    options->sort = SORT_MAX;
+  } else if (skip_string(data, "avg")) {
+    options->sort = SORT_AVERAGE;
+  } else {
+    query->error_message = "unknown sort option";
+    return false;
+  }
+
+  return true;
+}
+
+static bool parse_count_option(Query* query, char** data, int* count) {
+  skip_blank(data);
+
+  if (!is_number(**data)) {
+    query->error_message = "expecting a number";
+    return false;
+  }
+
+  *count = (int)get_double(data);
+  return true;
+}
+
+static bool parse_group_key(Query* query, char** data) {
+  Command* options = &query->options;
+  skip_blank(data);
+
+         if (skip_string(data, "desc")) {
+    options->group = GROUP_DESCRIPTION;
+  } else if (skip_string(data, "weekday")) {
+    options->group = GROUP_WEEKDAY;
+  } else if (skip_string(data, "day")) {
+    options->group = GROUP_DAY;
+  } else if (skip_string(data, "month")) {
+    options->group = GROUP_MONTH;
+  } else if (skip_string(data, "from")) {
+    options->group = GROUP_FROM;
+  } else if (skip_string(data, "to")) {
+    options->group = GROUP_TO;
+  } else {
+    query->error_message = "expecting desc, weekday, day, month, from or to";
+    return false;
+  }
+
+  return true;
+}
+
+// The transaction of an add request: the date, the source and destination accounts, the amount and an optional quoted description.
+static bool parse_transaction(Query* query, char* data) {
+  Command* options = &query->options;
+  Transaction* transaction = &options->transaction;
+  OptionsDate date = { 0 };
+
+  if (!try_parse_date(&data, &date) || date.wild || date.count != 3) {
+    query->error_message = "expecting a date like 24.dec.2023";
+    return false;
+  }
+
+  if (date.month < 1 || date.month > 12 || date.day < 1 || date.day > 31) {
+    query->error_message = "invalid date";
+    return false;
+  }
+
+  transaction->date = date.date;
+  transaction->reference = -1;
+
+  for (int i = 0; i < 2; i++) {
+    Account* account = get_account(query->journal, get_string_arena(query, &data));
+
+    if (!account || account->is_category) {
+      query->error_message = "expecting an account that is not a category";
+      return false;
+    }
+
+    if (i == 0) transaction->from = account->index;
+    else        transaction->to   = account->index;
+  }
+
+  skip_blank(&data);
+  if (!is_number(*data) && !(*data == '-' && is_number(data[1]))) {
+    query->error_message = "expecting an amount";
+    return false;
+  }
+
+  transaction->amount = get_double(&data);
+
+  skip_blank(&data);
+  if (*data == '\'') {
+    char* description = get_quoted_string(&data);
+    if (!description) {
+      query->error_message = "expecting a quoted description";
+      return false;
+    }
+
+    options->description = arena_push_string(&query->filter_data, description, strlen(description));
+  }
+
+  skip_blank(&data);
+  if (*data) {
+    query->error_message = "unexpected text after the transaction";
+    return false;
+  }
+
+  return true;
+}
+
+static bool skip_option(char** data, char* option, char* short_option) {
+  return skip_string(data, option) || skip_string(data, short_option);
+}
+
+static bool parse_options(Query* query, char* data) {
+  Command* options = &query->options;
+  while (true) {
+    skip_blank(&data);
+
+    if (*data == 0) return true;
+
+           if (skip_option(&data, "-monthly "  , "-m ")) {
+      options->monthly = true;
+    } else if (skip_option(&data, "-running "  , "-r ")) {
+      options->running = true;
+    } else if (skip_option(&data, "-nogrid "   , "-g ")) {
+      options->no_grid = true;
+    } else if (skip_option(&data, "-percent "   , "-p ")) {
+      options->percent = true;
+    } else if (skip_option(&data, "-sum "      , "-e ")) {
+      options->sum = true;
+    } else if (skip_option(&data, "-budget "   , "-b ")) {
+      options->budget = true;
+    } else if (skip_option(&data, "-refs "     , "-l ")) {
+      options->print_ref = true;
+    } else if (skip_option(&data, "-flat "     , "-c ")) {
+      options->flat = true;
+    } else if (skip_option(&data, "-zero "     , "-z ")) {
+      options->print_zeros = true;
+    } else if (skip_option(&data, "-date "     , "-d ")) {
+      if (!parse_date_option(query, &data)) return false;
+    } else if (skip_option(&data, "-at "       , "-a ")) {
+      if (!parse_at_option(query, &data)) return false;
+    } else if (skip_option(&data, "-stats "    , "-i ")) {
+      options->stats = true;
+    } else if (skip_option(&data, "-explain "  , "-x ")) {
+      options->explain = true;
+    } else if (skip_option(&data, "-limit "    , "-n ")) {
+      if (!parse_count_option(query, &data, &options->limit)) return false;
+    } else if (skip_option(&data, "-tail "     , "-k ")) {
+      if (!parse_count_option(query, &data, &options->tail)) return false;
+    } else if (skip_option(&data, "-sort "     , "-s ")) {
+      if (!parse_sort_option(query, &data)) return false;
+    } else if (skip_option(&data, "-unify "    , "-u ")) {
+      options->unify = true;
+    } else if (skip_option(&data, "-quarterly ", "-q ")) {
+      options->quarterly = true;
+    } else if (skip_option(&data, "-yearly "   , "-y")) {
+      options->yearly = true;
+    } else if (skip_option(&data, "-short "    , "-t")) {
+      options->is_short = true;
+    } else if (skip_option(&data, "-filter "   , "-f ")) {
+      options->filter = parse_filter(query, &data);
+      if (!options->filter) return false;
+      apply_filter(options->filter, 0);
+      if (optimize_filter(query->journal, &options->filter)) options->filter_modified = true;
+    } else {
+      query->error_message = "unknown option";
+      return false;
+    }
+  }
+}
+
+bool parse_command_line(Query* query, char* text, int mode) {
+  Command* options = &query->options;
+  bool speculative = (mode == PARSE_SPECULATIVE);
+  memset(options, 0, sizeof(Command));
+  arena_clear(query);
+  char buffer[INPUT_SIZE];
+  int size = strlen(text);
+  assert(size < INPUT_SIZE - 1);
+  strcpy(buffer, text);
+
+  // Append a space to match -option(space).
+  buffer[size    ] = ' ';
+  buffer[size + 1] = 0;
+
+  char* data = buffer;
+
+  skip_blank(&data);
+
+  int command;
+  if (skip_string(&data, "add")) {
+    if (speculative) return false;
+    options->type = COMMAND_ADD;
+    return mode != PARSE_REQUEST || parse_transaction(query, data);
+  } else if (skip_string(&data, "print")) {
+    options->type = COMMAND_PRINT;
+  } else if (skip_string(&data, "clear")) {
+    options->type = COMMAND_CLEAR;
+  } else if (skip_string(&data, "balance")) {
+    options->type = COMMAND_BALANCE;
+  } else if (skip_string(&data, "stats")) {
+    options->type = COMMAND_STATS;
+  } else if (skip_string(&data, "checkpoint")) {
+    if (speculative) return false;
+    options->type = COMMAND_CHECKPOINT;
+    if (!parse_count_option(query, &data, &options->year)) return false;
+  } else if (skip_string(&data, "archive")) {
+    if (speculative) return false;
+    options->type = COMMAND_ARCHIVE;
+    if (!parse_count_option(query, &data, &options->year)) return false;
+  } else if (skip_string(&data, "group")) {
+    options->type = COMMAND_GROUP;
+    if (!parse_group_key(query, &data)) return false;
+  } else {
+    query->error_message = "unknown command";
+    return false;
+  }
+
+  if (!parse_options(query, data)) return false;
+
+  if (options->sort >= SORT_COUNT && options->type != COMMAND_GROUP) {
+    query->error_message = "sorting by count, sum, min, max or avg is only for group";
+    return false;
+  }
+
+  if (speculative && options->type != COMMAND_PRINT && options->type != COMMAND_BALANCE && options->type != COMMAND_GROUP) return false;
+
+  return true;
+
+}
+
+// Parses a query for the library, which only runs print and balance commands. Returns the error message, or 0 with the command parsed
+// into it. Its filter is valid until the next parse of the query.
+char* parse_query(Query* query, char* text, Command* command) {
+  query->error_message = 0;
+
+  if (!parse_command_line(query, text, PARSE_SPECULATIVE)) {
+    return query->error_message ? query->error_message : "only print and balance commands are queries";
+  }
+
+  if (query->options.type == COMMAND_GROUP) return "only print and balance commands are queries";
+
+  *command = query->options;
+  return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "command.h"
+
+#define INPUT_SIZE 1024 // Longest command, with the terminating zero.
+
+enum {
+  PARSE_INPUT,
+  PARSE_SPECULATIVE, // Only accepts queries, that can be executed without changing the state.
+  PARSE_REQUEST,     // Sent to the server, which has no session to add a transaction in, so it is given on the line.
+};
+
+// Parses the command into query->options, with its filter in the filter arena of the query until the next parse. Returns false with
+// query->error_message if it does not parse, or is not accepted in the mode.
+bool  parse_command_line(Query* query, char* text, int mode);
+char* parse_query(Query* query, char* text, Command* command);
+
+#endif
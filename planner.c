@@ -0,0 +1,543 @@
+#include "planner.h"
+#include "optimizer.h"
+#include "results.h"
+#include "balances.h"
+#include "archive.h"
+#include "output.h"
+#include "basic.h"
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+
+// Chooses how the candidate rows of a query are read. The date order and the amount order are kept as persistent indices, with a posting
+// list per account of the positions in the date order where the account is used. A query reads either every row, the slice of the date
+// order within the date range, the merged posting lists of an account that every kept row must use, or the slice of the amount order
+// within the amount bounds. The rows are produced in date order, except when the amount order is read for -sort amount. Queries that were
+// run before, or that narrow a query that was run before, read the rows of the cached result instead.
+//
+// The indices are rebuilt when the journal is parsed again, and appended transactions are inserted into them. The account balances over
+// the date order are kept as well, such that running sums can start from the balances before a date slice.
+
+#define LEFT_INDENTATION   3
+#define MAX_ACCOUNT_TERMS  16
+#define ACCOUNT_MERGE_COST 2 // Relative cost of a merged row compared to a row in a contiguous slice.
+
+struct Indices {
+  Transaction* date_order[MAX_TRANSACTIONS];
+  Transaction* amount_order[MAX_TRANSACTIONS];
+  int date_positions[MAX_TRANSACTIONS]; // Position in the date order, by index in journal->raw_transactions.
+  int indexed_generation;
+  int indexed_count;
+
+  int posting_start[MAX_ACCOUNTS + 1];
+  int postings[2 * MAX_TRANSACTIONS]; // Ascending positions in the date order, grouped by account.
+};
+
+static char* plan_names[] = {
+  "full scan",
+  "date slice",
+  "account merge",
+  "amount index",
+  "cached result",
+  "refined result",
+};
+
+static Transaction* sort_date_get_first(Transaction* a, Transaction* b) {
+  return date_is_smaller(&a->date, &b->date) ? a : b;
+}
+
+Indices* planner_create() {
+  Indices* indices = calloc(1, sizeof(Indices));
+  assert(indices);
+  indices->indexed_generation = -1;
+  return indices;
+}
+
+static void start_line() {
+  set_x_cursor(LEFT_INDENTATION);
+}
+
+// Ascending amount, ties by descending date and then ascending index. This is the order of sorting the date order by amount, since the
+// merge sort puts ties in reverse order, and the date order has ties in reverse index order.
+static bool amount_is_before(Transaction* a, Transaction* b) {
+  if (a->amount != b->amount) return a->amount < b->amount;
+  if (!date_is_equal(&a->date, &b->date)) return date_is_bigger(&a->date, &b->date);
+  return a < b;
+}
+
+static int compare_amount_order(const void* a, const void* b) {
+  Transaction* x = *(Transaction**)a;
+  Transaction* y = *(Transaction**)b;
+  return amount_is_before(x, y) ? -1 : amount_is_before(y, x) ? 1 : 0;
+}
+
+// First position in the date order that is not before the date.
+static int date_lower_bound(Indices* indices, Date* date) {
+  int low = 0;
+  int high = indices->indexed_count;
+
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    if (date_is_smaller(&indices->date_order[middle]->date, date)) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  return low;
+}
+
+// First position in the date order that is after the date.
+static int date_upper_bound(Indices* indices, Date* date) {
+  int low = 0;
+  int high = indices->indexed_count;
+
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    if (date_is_bigger(&indices->date_order[middle]->date, date)) {
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+
+  return low;
+}
+
+// First position in the amount order with an amount above the bound, or not below it if inclusive.
+static int amount_bound(Indices* indices, double amount, bool inclusive) {
+  int low = 0;
+  int high = indices->indexed_count;
+
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    double x = indices->amount_order[middle]->amount;
+    if (inclusive ? x < amount : x <= amount) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  return low;
+}
+
+static int amount_insert_position(Indices* indices, Transaction* trans) {
+  int low = 0;
+  int high = indices->indexed_count;
+
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    if (amount_is_before(indices->amount_order[middle], trans)) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  return low;
+}
+
+static void insert(Transaction** order, int count, int position, Transaction* trans) {
+  memmove(&order[position + 1], &order[position], (count - position) * sizeof(Transaction*));
+  order[position] = trans;
+}
+
+// The date order is sorted with the amount order as the merge buffer, before the amount order is filled.
+static void build_orders(Journal* journal) {
+  Indices* indices = journal->indices;
+  int count = indices->indexed_count = journal->raw_transaction_count;
+
+  for (int i = 0; i < count; i++) indices->date_order[i] = &journal->raw_transactions[i];
+  journal_sort_transactions(indices->date_order, count, indices->amount_order, sort_date_get_first, false);
+
+  for (int i = 0; i < count; i++) indices->amount_order[i] = &journal->raw_transactions[i];
+  qsort(indices->amount_order, count, sizeof(Transaction*), compare_amount_order);
+  balances_update(journal->balances, indices->date_order, 0, count);
+}
+
+// Appended transactions come last in the journal, so in the date order they go before the transactions with the same date. Only the
+// balances from the first inserted position on are updated, which for an append on the last date are the ones of that date.
+static void insert_appended(Journal* journal) {
+  Indices* indices = journal->indices;
+  int first = indices->indexed_count;
+
+  while (indices->indexed_count < journal->raw_transaction_count) {
+    Transaction* trans = &journal->raw_transactions[indices->indexed_count];
+    int position = date_lower_bound(indices, &trans->date);
+
+    insert(indices->date_order,   indices->indexed_count, position, trans);
+    insert(indices->amount_order, indices->indexed_count, amount_insert_position(indices, trans), trans);
+
+    first = min(first, position);
+    indices->indexed_count++;
+  }
+
+  balances_update(journal->balances, indices->date_order, first, indices->indexed_count);
+}
+
+// True if the indices cover the journal as it is, such that updating them changes nothing.
+bool planner_is_current(Journal* journal) {
+  Indices* indices = journal->indices;
+  return indices->indexed_generation == journal->generation && indices->indexed_count == journal->raw_transaction_count;
+}
+
+void planner_update_indices(Journal* journal) {
+  Indices* indices = journal->indices;
+  if (planner_is_current(journal)) return;
+
+  if (indices->indexed_generation == journal->generation) {
+    insert_appended(journal);
+  } else {
+    build_orders(journal);
+  }
+
+  indices->indexed_generation = journal->generation;
+
+  int count = indices->indexed_count;
+  Transaction** date_order = indices->date_order;
+
+  for (int i = 0; i < count; i++)
+    indices->date_positions[date_order[i] - journal->raw_transactions] = i;
+
+  int sizes[MAX_ACCOUNTS] = { 0 };
+
+  for (int i = 0; i < count; i++) {
+    Transaction* trans = date_order[i];
+    sizes[trans->from]++;
+    if (trans->to != trans->from) sizes[trans->to]++;
+  }
+
+  int* posting_start = indices->posting_start;
+  posting_start[0] = 0;
+  for (int i = 0; i < MAX_ACCOUNTS; i++) posting_start[i + 1] = posting_start[i] + sizes[i];
+
+  int fill[MAX_ACCOUNTS];
+  memcpy(fill, posting_start, sizeof(fill));
+
+  for (int i = 0; i < count; i++) {
+    Transaction* trans = date_order[i];
+    indices->postings[fill[trans->from]++] = i;
+    if (trans->to != trans->from) indices->postings[fill[trans->to]++] = i;
+  }
+}
+
+static int* position_lower_bound(int* begin, int* end, int position) {
+  while (begin < end) {
+    int* middle = begin + (end - begin) / 2;
+    if (*middle < position) {
+      begin = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+
+  return begin;
+}
+
+static int count_account_rows(Indices* indices, PrimaryFilter* account, int start, int end) {
+  int count = 0;
+
+  for (int i = account->index; i < account->index + account->count; i++) {
+    int* begin = &indices->postings[indices->posting_start[i]];
+    int* stop  = &indices->postings[indices->posting_start[i + 1]];
+    count += position_lower_bound(begin, stop, end) - position_lower_bound(begin, stop, start);
+  }
+
+  return count;
+}
+
+// Account filters that every kept transaction must satisfy, the operands of the top level and chain. In unified mode the filter is also
+// applied with the accounts swapped, which is fine since the posting lists contain both the source and the destination.
+static void find_account_filters(Filter* filter, PrimaryFilter** found, int* count) {
+  if (filter->type == FILTER_BINARY && filter->binary.type == BINARY_AND) {
+    find_account_filters(filter->binary.left,  found, count);
+    find_account_filters(filter->binary.right, found, count);
+  } else if (filter->type == FILTER_PRIMARY && *count < MAX_ACCOUNT_TERMS) {
+    int type = filter->primary.type;
+    if (type == PRIMARY_FROM || type == PRIMARY_TO || type == PRIMARY_ACCOUNT) found[(*count)++] = &filter->primary;
+  }
+}
+
+typedef struct {
+  double low;
+  double high;
+  bool low_inclusive;
+  bool high_inclusive;
+} AmountBounds;
+
+static bool is_amount(Filter* filter) {
+  return filter->type == FILTER_PRIMARY && filter->primary.type == PRIMARY_AMOUNT;
+}
+
+static bool is_number(Filter* filter) {
+  return filter->type == FILTER_PRIMARY && filter->primary.type == PRIMARY_NUMBER;
+}
+
+static void raise_low(AmountBounds* bounds, double x, bool inclusive) {
+  if (x > bounds->low || (x == bounds->low && !inclusive)) {
+    bounds->low = x;
+    bounds->low_inclusive = inclusive;
+  }
+}
+
+static void lower_high(AmountBounds* bounds, double x, bool inclusive) {
+  if (x < bounds->high || (x == bounds->high && !inclusive)) {
+    bounds->high = x;
+    bounds->high_inclusive = inclusive;
+  }
+}
+
+// Narrows the bounds by the amount comparisons in the top level and chain, like amount > 100 or 500 >= amount.
+static void find_amount_bounds(Filter* filter, AmountBounds* bounds) {
+  if (filter->type != FILTER_BINARY) return;
+
+  int type = filter->binary.type;
+  Filter* left  = filter->binary.left;
+  Filter* right = filter->binary.right;
+
+  if (type == BINARY_AND) {
+    find_amount_bounds(left,  bounds);
+    find_amount_bounds(right, bounds);
+    return;
+  }
+
+  // Write the comparison as amount <op> number.
+  if (is_number(left) && is_amount(right)) {
+    Filter* tmp = left;
+    left  = right;
+    right = tmp;
+
+    switch (type) {
+      case BINARY_LESS_THAN:     type = BINARY_GREATER_THAN;  break;
+      case BINARY_GREATER_THAN:  type = BINARY_LESS_THAN;     break;
+      case BINARY_LESS_EQUAL:    type = BINARY_GREATER_EQUAL; break;
+      case BINARY_GREATER_EQUAL: type = BINARY_LESS_EQUAL;    break;
+    }
+  }
+
+  if (!is_amount(left) || !is_number(right)) return;
+
+  double x = right->primary.number;
+
+  switch (type) {
+    case BINARY_EQUAL:
+      raise_low(bounds, x, true);
+      lower_high(bounds, x, true);
+      break;
+    case BINARY_GREATER_THAN:  raise_low(bounds, x, false);  break;
+    case BINARY_GREATER_EQUAL: raise_low(bounds, x, true);   break;
+    case BINARY_LESS_THAN:     lower_high(bounds, x, false); break;
+    case BINARY_LESS_EQUAL:    lower_high(bounds, x, true);  break;
+  }
+}
+
+static double get_sort_cost(double count) {
+  return (count > 1) ? count * log2(count) : 0;
+}
+
+Plan plan_query(Query* query, Command* command) {
+  Journal* journal = query->journal;
+  Indices* indices = journal->indices;
+  planner_update_indices(journal);
+
+  Plan plan = { 0 };
+  plan.type  = PLAN_FULL_SCAN;
+  plan.start = 0;
+  plan.end   = indices->indexed_count;
+
+  int cached = find_result(query, command);
+
+  if (cached != RESULT_MISS) {
+    plan.type = (cached == RESULT_HIT) ? PLAN_CACHED_RESULT : PLAN_REFINED_RESULT;
+    plan.rows_read = get_result_row_count(query);
+    plan.estimated_rows = plan.rows_read;
+
+    if (cached == RESULT_REFINE)
+      plan.estimated_rows = min(plan.rows_read, indices->indexed_count * estimate_selectivity(journal, command->filter));
+
+    return plan;
+  }
+
+  if (command->date_present) {
+    plan.type  = PLAN_DATE_SLICE;
+    plan.start = date_lower_bound(indices, &command->from.date);
+    plan.end   = max(plan.start, date_upper_bound(indices, &command->to.date));
+  }
+
+  // The balance view does not filter transactions.
+  bool filtered = command->filter && command->type != COMMAND_BALANCE;
+  double selectivity = filtered ? estimate_selectivity(journal, command->filter) : 1;
+  plan.estimated_rows = (plan.end - plan.start) * selectivity;
+
+  // Running sums start from the balances before the slice, and include every transaction in it.
+  if (command->running) {
+    plan.rows_read = plan.end - plan.start;
+    return plan;
+  }
+
+  if (filtered) {
+    PrimaryFilter* accounts[MAX_ACCOUNT_TERMS];
+    int account_count = 0;
+    find_account_filters(command->filter, accounts, &account_count);
+
+    int best_cost = plan.end - plan.start;
+
+    for (int i = 0; i < account_count; i++) {
+      int cost = ACCOUNT_MERGE_COST * count_account_rows(indices, accounts[i], plan.start, plan.end);
+      if (cost < best_cost) {
+        best_cost = cost;
+        plan.type = PLAN_ACCOUNT_MERGE;
+        plan.account = accounts[i];
+      }
+    }
+  }
+
+  // Transactions within the account on both sides are counted twice, until the posting lists are merged.
+  if (plan.type == PLAN_ACCOUNT_MERGE) {
+    plan.rows_read = count_account_rows(indices, plan.account, plan.start, plan.end);
+  } else {
+    plan.rows_read = plan.end - plan.start;
+  }
+
+  // The amount order replaces sorting the kept rows by amount, and its bounds replace scanning for amount ranges. In unified mode the
+  // filter also sees the negated amount, so only the sort can use it.
+  bool sort_amount = command->type == COMMAND_PRINT && command->sort == SORT_AMOUNT;
+
+  AmountBounds bounds = { -INFINITY, INFINITY, true, true };
+  if (filtered && !command->unify) find_amount_bounds(command->filter, &bounds);
+
+  int amount_start = amount_bound(indices, bounds.low, bounds.low_inclusive);
+  int amount_end   = max(amount_start, amount_bound(indices, bounds.high, !bounds.high_inclusive));
+  int amount_rows  = amount_end - amount_start;
+
+  double date_cost   = plan.rows_read * ((plan.type == PLAN_ACCOUNT_MERGE) ? ACCOUNT_MERGE_COST : 1);
+  double amount_cost = amount_rows;
+
+  if (sort_amount) {
+    date_cost += get_sort_cost(plan.estimated_rows);
+  } else {
+    amount_cost += get_sort_cost(amount_rows);
+  }
+
+  if (amount_cost < date_cost) {
+    plan.type  = PLAN_AMOUNT_INDEX;
+    plan.start = amount_start;
+    plan.end   = amount_end;
+    plan.account = 0;
+    plan.amount_ordered = sort_amount;
+    plan.rows_read = amount_rows;
+  }
+
+  return plan;
+}
+
+static int compare_positions(const void* a, const void* b) {
+  return *(int*)a - *(int*)b;
+}
+
+// Merges the posting lists of the account and its subaccounts within the date slice, dropping transactions that are listed twice.
+static int merge_account_rows(Query* query, Plan* plan) {
+  Indices* indices = query->journal->indices;
+  int (*merge_buffers)[2 * MAX_TRANSACTIONS] = query->merge_buffers;
+  int* merged = merge_buffers[0];
+  int merged_count = 0;
+
+  PrimaryFilter* account = plan->account;
+
+  for (int i = account->index; i < account->index + account->count; i++) {
+    int* end  = &indices->postings[indices->posting_start[i + 1]];
+    int* list = position_lower_bound(&indices->postings[indices->posting_start[i]], end, plan->start);
+    int* stop = position_lower_bound(list, end, plan->end);
+    int* out  = (merged == merge_buffers[0]) ? merge_buffers[1] : merge_buffers[0];
+
+    int a = 0;
+    int count = 0;
+
+    while (a < merged_count || list < stop) {
+      if (list == stop || (a < merged_count && merged[a] < *list)) {
+        out[count++] = merged[a++];
+      } else {
+        if (a < merged_count && merged[a] == *list) a++;
+        out[count++] = *list++;
+      }
+    }
+
+    merged = out;
+    merged_count = count;
+  }
+
+  if (merged != merge_buffers[0]) memcpy(merge_buffers[0], merged, merged_count * sizeof(int));
+  return merged_count;
+}
+
+// Stores the rows read by the plan, in date order unless the plan is amount ordered, returns the row count. A cached result also
+// restores the printed postings of the unified view into sides.
+int plan_get_rows(Query* query, Plan* plan, Transaction** rows, u8* sides) {
+  if (plan->type == PLAN_CACHED_RESULT || plan->type == PLAN_REFINED_RESULT)
+    return get_result_rows(query, rows, sides);
+
+  Journal* journal = query->journal;
+  Indices* indices = journal->indices;
+  int* positions = query->merge_buffers[0];
+
+  // Rows of the amount order are put in date order by sorting their positions in the date order.
+  if (plan->type == PLAN_AMOUNT_INDEX) {
+    int count = plan->end - plan->start;
+    memcpy(rows, &indices->amount_order[plan->start], count * sizeof(Transaction*));
+    if (plan->amount_ordered) return count;
+
+    for (int i = 0; i < count; i++) positions[i] = indices->date_positions[rows[i] - journal->raw_transactions];
+    qsort(positions, count, sizeof(int), compare_positions);
+    for (int i = 0; i < count; i++) rows[i] = indices->date_order[positions[i]];
+    return count;
+  }
+
+  if (plan->type != PLAN_ACCOUNT_MERGE) {
+    int count = plan->end - plan->start;
+    memcpy(rows, &indices->date_order[plan->start], count * sizeof(Transaction*));
+    return count;
+  }
+
+  int count = merge_account_rows(query, plan);
+  for (int i = 0; i < count; i++) rows[i] = indices->date_order[positions[i]];
+
+  plan->rows_read = count;
+  return count;
+}
+
+// Balances of every account before the first row of the plan, where running sums start.
+void plan_get_start_sums(Journal* journal, Plan* plan, double* sums) {
+  get_balances_before(journal, plan->type == PLAN_DATE_SLICE ? plan->start : 0, sums);
+}
+
+// Balances of every account at the end of the date.
+void get_balances_at(Journal* journal, Date* date, double* sums) {
+  planner_update_indices(journal);
+  get_balances_before(journal, date_upper_bound(journal->indices, date), sums);
+  archive_add_sums_before(journal, date, true, sums);
+}
+
+void print_plan(Journal* journal, Plan* plan, int actual_rows) {
+  start_line();
+  print("%-16s %s", "plan", plan_names[plan->type]);
+
+  if (plan->type == PLAN_ACCOUNT_MERGE) {
+    char* prefix = (plan->account->type == PRIMARY_FROM) ? "from" : (plan->account->type == PRIMARY_TO) ? "to" : "account";
+    print(" on %s %s", prefix, plan->account->string);
+
+    PrimaryFilter* account = plan->account;
+    Account* first = &journal->accounts[account->index];
+    if (account->count > first->count) print("..%s", first[account->count - 1].path);
+  }
+
+  print("\n");
+  start_line();
+  print("%-16s %10d\n", "rows read", plan->rows_read);
+  start_line();
+  print("%-16s %10.0lf\n", "estimated rows", plan->estimated_rows);
+  start_line();
+  print("%-16s %10d\n", "actual rows", actual_rows);
+}
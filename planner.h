@@ -0,0 +1,34 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include "command.h"
+
+enum {
+  PLAN_FULL_SCAN,
+  PLAN_DATE_SLICE,
+  PLAN_ACCOUNT_MERGE,
+  PLAN_AMOUNT_INDEX,
+  PLAN_CACHED_RESULT,
+  PLAN_REFINED_RESULT,
+};
+
+typedef struct {
+  int type;
+  int start; // Slice of the date order, or of the amount order for the amount index, that is read.
+  int end;
+  PrimaryFilter* account; // Account filter whose posting lists are merged.
+  bool amount_ordered;    // The rows are produced in ascending amount order instead of date order.
+  int rows_read;
+  double estimated_rows;
+} Plan;
+
+Indices* planner_create();
+bool planner_is_current(Journal* journal);
+void planner_update_indices(Journal* journal);
+Plan plan_query(Query* query, Command* command);
+int  plan_get_rows(Query* query, Plan* plan, Transaction** rows, u8* sides);
+void plan_get_start_sums(Journal* journal, Plan* plan, double* sums);
+void get_balances_at(Journal* journal, Date* date, double* sums);
+void print_plan(Journal* journal, Plan* plan, int actual_rows);
+
+#endif
@@ -0,0 +1,105 @@
+#include "pool.h"
+#include "basic.h"
+#include "trace.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <assert.h>
+
+// Persistent worker threads. The calling thread takes part in running the tasks, and pool_run returns when all tasks are done. The pool
+// runs the tasks of one caller at a time, when other threads call pool_run meanwhile they run their tasks themselves.
+
+static pthread_t workers[MAX_THREADS];
+static int worker_count;
+static pthread_once_t initialized = PTHREAD_ONCE_INIT;
+static bool busy;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  start_condition = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  done_condition  = PTHREAD_COND_INITIALIZER;
+
+static PoolTask current_task;
+static void* current_data;
+static int task_count;
+static int next_task;
+static int finished_workers;
+static int generation;
+
+static void run_tasks() {
+  while (true) {
+    int index = __atomic_fetch_add(&next_task, 1, __ATOMIC_ACQ_REL);
+    if (index >= task_count) return;
+
+    trace_begin("task");
+    current_task(index, current_data);
+    trace_end("task");
+  }
+}
+
+static void* worker_main(void* argument) {
+  int seen_generation = 0;
+
+  while (true) {
+    pthread_mutex_lock(&mutex);
+    while (generation == seen_generation) pthread_cond_wait(&start_condition, &mutex);
+    seen_generation = generation;
+    pthread_mutex_unlock(&mutex);
+
+    run_tasks();
+
+    pthread_mutex_lock(&mutex);
+    if (++finished_workers == worker_count) pthread_cond_signal(&done_condition);
+    pthread_mutex_unlock(&mutex);
+  }
+
+  return 0;
+}
+
+static void pool_init() {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  worker_count = limit((int)cores, 1, MAX_THREADS) - 1;
+
+  for (int i = 0; i < worker_count; i++) {
+    assert(pthread_create(&workers[i], 0, worker_main, 0) == 0);
+  }
+}
+
+int pool_thread_count() {
+  pthread_once(&initialized, pool_init);
+  return worker_count + 1;
+}
+
+void pool_run(PoolTask task, int count, void* data) {
+  pthread_once(&initialized, pool_init);
+
+  if (worker_count == 0 || count <= 1) {
+    for (int i = 0; i < count; i++) task(i, data);
+    return;
+  }
+
+  pthread_mutex_lock(&mutex);
+
+  // The workers run the tasks of another thread.
+  if (busy) {
+    pthread_mutex_unlock(&mutex);
+    for (int i = 0; i < count; i++) task(i, data);
+    return;
+  }
+
+  busy = true;
+  current_task = task;
+  current_data = data;
+  task_count = count;
+  next_task = 0;
+  finished_workers = 0;
+  generation++;
+  pthread_cond_broadcast(&start_condition);
+  pthread_mutex_unlock(&mutex);
+
+  run_tasks();
+
+  pthread_mutex_lock(&mutex);
+  while (finished_workers < worker_count) pthread_cond_wait(&done_condition, &mutex);
+  busy = false;
+  pthread_mutex_unlock(&mutex);
+}
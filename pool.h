@@ -0,0 +1,11 @@
+#ifndef POOL_H
+#define POOL_H
+
+#define MAX_THREADS 64
+
+typedef void (*PoolTask)(int index, void* data);
+
+int  pool_thread_count();
+void pool_run(PoolTask task, int count, void* data);
+
+#endif
@@ -0,0 +1,441 @@
+#include "regex.h"
+#include "basic.h"
+#include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+
+// Case insensitive regular expressions, compiled to a Thompson NFA and matched with a lazily built DFA. Matching is linear in the input,
+// there is no backtracking. Supported: literals, ., [...], [^...], \d \w \s \D \W \S, ^, $, (...), |, *, + and ?.
+
+#define MAX_NFA_STATES 512
+#define MAX_DFA_STATES 128
+#define SET_POOL_SIZE  (64 * MAX_NFA_STATES)
+
+enum {
+  STATE_CHAR,
+  STATE_EMPTY,
+  STATE_SPLIT,
+  STATE_BEGIN,
+  STATE_END,
+  STATE_MATCH,
+};
+
+typedef struct {
+  u8  type;
+  int out;
+  int out2;
+  u32 set[8]; // Character class for STATE_CHAR.
+} NfaState;
+
+typedef struct {
+  int* states; // Sorted NFA states, only characters, ends and matches.
+  int  count;
+  u32  hash;
+  bool accepting;
+  bool accepting_at_end;
+  s16  next[256];
+} DfaState;
+
+typedef struct {
+  int start;
+  int end; // STATE_EMPTY with an unpatched out.
+} Fragment;
+
+struct Regex {
+  NfaState states[MAX_NFA_STATES];
+  int state_count;
+  int start;
+
+  DfaState dfa[MAX_DFA_STATES];
+  int dfa_count;
+  int initial;
+  int flush_count;
+
+  int set_pool[SET_POOL_SIZE];
+  int set_pool_used;
+
+  int marks[MAX_NFA_STATES];
+  int mark;
+
+  char* cursor;
+  bool failed;
+};
+
+static int new_state(Regex* regex, int type) {
+  if (regex->state_count == MAX_NFA_STATES) {
+    regex->failed = true;
+    return 0;
+  }
+
+  int index = regex->state_count++;
+  NfaState* state = &regex->states[index];
+  memset(state, 0, sizeof(NfaState));
+  state->type = type;
+  state->out  = -1;
+  state->out2 = -1;
+  return index;
+}
+
+static void set_add(u32* set, int c) {
+  set[(u8)c >> 5] |= 1u << ((u8)c & 31);
+}
+
+static bool set_has(u32* set, int c) {
+  return set[(u8)c >> 5] & (1u << ((u8)c & 31));
+}
+
+static void set_add_folded(u32* set, int c) {
+  set_add(set, c);
+  set_add(set, tolower((u8)c));
+  set_add(set, toupper((u8)c));
+}
+
+static Fragment new_fragment(Regex* regex, int type) {
+  Fragment fragment;
+  fragment.start = new_state(regex, type);
+  fragment.end   = new_state(regex, STATE_EMPTY);
+  regex->states[fragment.start].out = fragment.end;
+  return fragment;
+}
+
+static Fragment concatenate(Regex* regex, Fragment a, Fragment b) {
+  regex->states[a.end].out = b.start;
+  return (Fragment){ a.start, b.end };
+}
+
+static Fragment alternate(Regex* regex, Fragment a, Fragment b) {
+  int split = new_state(regex, STATE_SPLIT);
+  int end   = new_state(regex, STATE_EMPTY);
+
+  regex->states[split].out  = a.start;
+  regex->states[split].out2 = b.start;
+  regex->states[a.end].out  = end;
+  regex->states[b.end].out  = end;
+
+  return (Fragment){ split, end };
+}
+
+static Fragment repeat(Regex* regex, Fragment a, char operator) {
+  int split = new_state(regex, STATE_SPLIT);
+  int end   = new_state(regex, STATE_EMPTY);
+
+  regex->states[split].out  = a.start;
+  regex->states[split].out2 = end;
+
+  if (operator == '?') {
+    regex->states[a.end].out = end;
+  } else {
+    regex->states[a.end].out = split;
+  }
+
+  return (Fragment){ (operator == '+') ? a.start : split, end };
+}
+
+static void add_escape_class(u32* set, char c) {
+  u32 class[8] = { 0 };
+  char lower = tolower((u8)c);
+
+  for (int i = 1; i < 256; i++) {
+    bool member = (lower == 'd' && isdigit(i)) || (lower == 'w' && (isalnum(i) || i == '_')) || (lower == 's' && isspace(i));
+    if (member) set_add(class, i);
+  }
+
+  // Uppercase classes are negated.
+  for (int i = 0; i < 8; i++) set[i] |= (c == lower) ? class[i] : ~class[i];
+}
+
+static bool is_escape_class(char c) {
+  return strchr("dwsDWS", c) != 0;
+}
+
+static Fragment parse_alternation(Regex* regex);
+
+static Fragment parse_class(Regex* regex) {
+  Fragment fragment = new_fragment(regex, STATE_CHAR);
+  u32* set = regex->states[fragment.start].set;
+  u32 class[8] = { 0 };
+
+  bool negate = (*regex->cursor == '^');
+  if (negate) regex->cursor++;
+
+  bool first = true;
+  while (*regex->cursor && (*regex->cursor != ']' || first)) {
+    char c = *regex->cursor++;
+    first = false;
+
+    if (c == '\\' && *regex->cursor) {
+      c = *regex->cursor++;
+      if (is_escape_class(c)) {
+        add_escape_class(class, c);
+        continue;
+      }
+    }
+
+    if (regex->cursor[0] == '-' && regex->cursor[1] && regex->cursor[1] != ']') {
+      char last = regex->cursor[1];
+      regex->cursor += 2;
+      for (int i = (u8)c; i <= (u8)last; i++) set_add_folded(class, i);
+    } else {
+      set_add_folded(class, c);
+    }
+  }
+
+  if (*regex->cursor != ']') {
+    regex->failed = true;
+    return fragment;
+  }
+
+  regex->cursor++;
+
+  for (int i = 0; i < 8; i++) set[i] = negate ? ~class[i] : class[i];
+  set[0] &= ~1u; // Never match the terminator.
+  return fragment;
+}
+
+static Fragment parse_atom(Regex* regex) {
+  char c = *regex->cursor++;
+
+  if (c == '(') {
+    Fragment fragment = parse_alternation(regex);
+    if (*regex->cursor != ')') {
+      regex->failed = true;
+    } else {
+      regex->cursor++;
+    }
+    return fragment;
+  }
+
+  if (c == '[') return parse_class(regex);
+  if (c == '^') return new_fragment(regex, STATE_BEGIN);
+  if (c == '$') return new_fragment(regex, STATE_END);
+
+  if (c == '*' || c == '+' || c == '?' || c == ')') {
+    regex->failed = true;
+    return new_fragment(regex, STATE_EMPTY);
+  }
+
+  Fragment fragment = new_fragment(regex, STATE_CHAR);
+  u32* set = regex->states[fragment.start].set;
+
+  if (c == '.') {
+    for (int i = 1; i < 256; i++) set_add(set, i);
+  } else if (c == '\\' && *regex->cursor) {
+    c = *regex->cursor++;
+    if (is_escape_class(c)) {
+      add_escape_class(set, c);
+      set[0] &= ~1u;
+    } else {
+      set_add_folded(set, c);
+    }
+  } else {
+    set_add_folded(set, c);
+  }
+
+  return fragment;
+}
+
+static Fragment parse_repeat(Regex* regex) {
+  Fragment fragment = parse_atom(regex);
+
+  while (*regex->cursor == '*' || *regex->cursor == '+' || *regex->cursor == '?') {
+    fragment = repeat(regex, fragment, *regex->cursor++);
+  }
+
+  return fragment;
+}
+
+static Fragment parse_concatenation(Regex* regex) {
+  Fragment fragment = new_fragment(regex, STATE_EMPTY);
+
+  while (*regex->cursor && *regex->cursor != '|' && *regex->cursor != ')' && !regex->failed) {
+    fragment = concatenate(regex, fragment, parse_repeat(regex));
+  }
+
+  return fragment;
+}
+
+static Fragment parse_alternation(Regex* regex) {
+  Fragment fragment = parse_concatenation(regex);
+
+  while (*regex->cursor == '|' && !regex->failed) {
+    regex->cursor++;
+    fragment = alternate(regex, fragment, parse_concatenation(regex));
+  }
+
+  return fragment;
+}
+
+static int compare_ints(const void* a, const void* b) {
+  return *(int*)a - *(int*)b;
+}
+
+// Follows empty transitions from the seeds. Begin states are only followed at the start of the input and end states at the end of it.
+// Returns the sorted states that consume characters, wait for the end, or match.
+static int closure(Regex* regex, int* seeds, int seed_count, bool at_begin, bool at_end, int* result) {
+  int stack[2 * MAX_NFA_STATES];
+  int stack_size = 0;
+  int count = 0;
+
+  regex->mark++;
+
+  for (int i = 0; i < seed_count; i++) stack[stack_size++] = seeds[i];
+
+  while (stack_size) {
+    int index = stack[--stack_size];
+    if (index < 0 || regex->marks[index] == regex->mark) continue;
+    regex->marks[index] = regex->mark;
+
+    NfaState* state = &regex->states[index];
+
+    switch (state->type) {
+      case STATE_EMPTY:
+        stack[stack_size++] = state->out;
+        break;
+      case STATE_SPLIT:
+        stack[stack_size++] = state->out2;
+        stack[stack_size++] = state->out;
+        break;
+      case STATE_BEGIN:
+        if (at_begin) stack[stack_size++] = state->out;
+        break;
+      case STATE_END:
+        if (at_end) {
+          stack[stack_size++] = state->out;
+        } else {
+          result[count++] = index;
+        }
+        break;
+      default:
+        result[count++] = index;
+    }
+  }
+
+  // Insertion sort, the sets are small.
+  for (int i = 1; i < count; i++) {
+    int value = result[i];
+    int j = i - 1;
+    while (j >= 0 && result[j] > value) {
+      result[j + 1] = result[j];
+      j--;
+    }
+    result[j + 1] = value;
+  }
+
+  return count;
+}
+
+static bool contains_match(Regex* regex, int* states, int count) {
+  for (int i = 0; i < count; i++) {
+    if (regex->states[states[i]].type == STATE_MATCH) return true;
+  }
+  return false;
+}
+
+static void flush_dfa(Regex* regex) {
+  regex->dfa_count = 0;
+  regex->set_pool_used = 0;
+  regex->initial = -1;
+  regex->flush_count++;
+}
+
+static int find_or_add_dfa_state(Regex* regex, int* states, int count) {
+  u32 hash = 2166136261u;
+  for (int i = 0; i < count; i++) hash = (hash ^ states[i]) * 16777619u;
+
+  for (int i = 0; i < regex->dfa_count; i++) {
+    DfaState* state = &regex->dfa[i];
+    if (state->hash == hash && state->count == count && !memcmp(state->states, states, count * sizeof(int))) return i;
+  }
+
+  if (regex->dfa_count == MAX_DFA_STATES || regex->set_pool_used + count > SET_POOL_SIZE) {
+    flush_dfa(regex);
+  }
+
+  DfaState* state = &regex->dfa[regex->dfa_count];
+  state->states = &regex->set_pool[regex->set_pool_used];
+  state->count  = count;
+  state->hash   = hash;
+  memcpy(state->states, states, count * sizeof(int));
+  memset(state->next, 0xff, sizeof(state->next));
+  regex->set_pool_used += count;
+
+  state->accepting = contains_match(regex, states, count);
+
+  // Matches if the input ends here and the pending end states lead to the match state.
+  int seeds[MAX_NFA_STATES];
+  int seed_count = 0;
+  for (int i = 0; i < count; i++) {
+    if (regex->states[states[i]].type == STATE_END) seeds[seed_count++] = regex->states[states[i]].out;
+  }
+
+  int end_states[MAX_NFA_STATES];
+  int end_count = closure(regex, seeds, seed_count, false, true, end_states);
+  state->accepting_at_end = state->accepting || contains_match(regex, end_states, end_count);
+
+  return regex->dfa_count++;
+}
+
+static int get_initial_state(Regex* regex) {
+  if (regex->initial < 0) {
+    int states[MAX_NFA_STATES];
+    int count = closure(regex, &regex->start, 1, true, false, states);
+    regex->initial = find_or_add_dfa_state(regex, states, count);
+  }
+  return regex->initial;
+}
+
+static int step(Regex* regex, int index, u8 c) {
+  DfaState* state = &regex->dfa[index];
+  if (state->next[c] >= 0) return state->next[c];
+
+  int seeds[MAX_NFA_STATES + 1];
+  int seed_count = 0;
+
+  for (int i = 0; i < state->count; i++) {
+    NfaState* nfa_state = &regex->states[state->states[i]];
+    if (nfa_state->type == STATE_CHAR && set_has(nfa_state->set, c)) seeds[seed_count++] = nfa_state->out;
+  }
+
+  // The match can start at any position.
+  seeds[seed_count++] = regex->start;
+
+  int states[MAX_NFA_STATES];
+  int count = closure(regex, seeds, seed_count, false, false, states);
+
+  int flush_count = regex->flush_count;
+  int next = find_or_add_dfa_state(regex, states, count);
+
+  if (regex->flush_count == flush_count) state->next[c] = next;
+  return next;
+}
+
+Regex* regex_compile(char* pattern, Arena* arena) {
+  Regex* regex = arena_push(arena, sizeof(Regex));
+  memset(regex, 0, offsetof(Regex, set_pool));
+  memset(regex->marks, 0, sizeof(regex->marks));
+
+  regex->cursor = pattern;
+
+  Fragment fragment = parse_alternation(regex);
+  if (*regex->cursor) regex->failed = true;
+  if (regex->failed) return 0;
+
+  int match = new_state(regex, STATE_MATCH);
+  if (regex->failed) return 0;
+
+  regex->states[fragment.end].out = match;
+  regex->start = fragment.start;
+  regex->initial = -1;
+  return regex;
+}
+
+bool regex_match(Regex* regex, char* data, int size) {
+  int state = get_initial_state(regex);
+
+  for (int i = 0; i < size; i++) {
+    if (regex->dfa[state].accepting) return true;
+    state = step(regex, state, data[i]);
+  }
+
+  return regex->dfa[state].accepting_at_end;
+}
@@ -0,0 +1,12 @@
+#ifndef REGEX_H
+#define REGEX_H
+
+#include "arena.h"
+#include <stdbool.h>
+
+typedef struct Regex Regex;
+
+Regex* regex_compile(char* pattern, Arena* arena);
+bool   regex_match(Regex* regex, char* data, int size);
+
+#endif
@@ -0,0 +1,351 @@
+#include "results.h"
+#include "journal.h"
+#include "parser.h"
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+
+// Results of recent queries, the kept transactions in date order with their printed postings and running sums, and the periods of the balance
+// view. A query is keyed by what decides the kept transactions: the operands of the top level and chain of its filter, the date range and
+// the options that change the filter or the sums. Sorting, limits and layout options are applied to the cached rows as usual.
+//
+// A print query whose and chain contains every operand of a cached one keeps a subset of its rows, so only those rows are filtered.
+// Entries are dropped when the journal is parsed again or appended to.
+//
+// Queries on separate threads share the cache. An entry that an executing command reads or stored is pinned until the command is done,
+// such that it is not replaced under it, and stored periods are only added once. The rest of a pinned entry does not change.
+
+#define MAX_CACHED_RESULTS 8
+#define MAX_KEY_LENGTH     (2 * INPUT_SIZE)
+#define MAX_CONJUNCTS      64
+
+typedef struct {
+  int type;
+  bool date_present;
+  Date from;
+  Date to;
+  bool unify;
+  bool running;
+  bool monthly;
+  bool quarterly;
+  bool yearly;
+  int conjunct_count;
+  char conjuncts[MAX_KEY_LENGTH]; // Sorted filter texts of the and operands, one per line.
+} ResultKey;
+
+typedef struct {
+  ResultKey key;
+  int generation;
+  int transaction_count; // Size of the journal when the result was stored.
+  u64 last_used;
+  int users; // Pins of executing commands.
+
+  int row_count;
+  int rows[MAX_TRANSACTIONS]; // Index in journal->raw_transactions.
+  u8 sides[MAX_TRANSACTIONS]; // Printed postings of the unified view.
+  double from_sums[MAX_TRANSACTIONS];
+  double to_sums[MAX_TRANSACTIONS];
+
+  bool has_periods;
+  int period_count;
+  Period periods[MAX_PERIODS];
+  double initial_sums[MAX_ACCOUNTS];
+} CachedResult;
+
+struct ResultCache {
+  CachedResult entries[MAX_CACHED_RESULTS];
+  u64 use_counter;
+  pthread_mutex_t mutex;
+};
+
+// The cache entries used by the executing command of a query.
+struct ResultLookup {
+  CachedResult* current; // The entry that was hit or stored by the current command.
+  CachedResult* found;   // The entry whose rows are read.
+  ResultKey key;
+  bool key_valid;
+
+  char conjunct_texts[MAX_CONJUNCTS][MAX_KEY_LENGTH];
+  char* sorted_texts[MAX_CONJUNCTS];
+};
+
+ResultCache* results_create() {
+  ResultCache* cache = calloc(1, sizeof(ResultCache));
+  assert(cache);
+  assert(pthread_mutex_init(&cache->mutex, 0) == 0);
+  return cache;
+}
+
+static int compare_texts(const void* a, const void* b) {
+  return strcmp(*(char**)a, *(char**)b);
+}
+
+// Formats the operands of the and chain, ignoring the parenthesis around each of them. Returns false if the filter does not fit.
+static bool add_conjuncts(Query* query, Filter* filter, int* count) {
+  if (filter->type == FILTER_BINARY && filter->binary.type == BINARY_AND)
+    return add_conjuncts(query, filter->binary.left, count) && add_conjuncts(query, filter->binary.right, count);
+
+  if (*count == MAX_CONJUNCTS) return false;
+
+  ResultLookup* lookup = query->result;
+  char* text = lookup->conjunct_texts[*count];
+  bool parenthesized = filter->parenthesized;
+  filter->parenthesized = false;
+
+  text[0] = 0;
+  format_filter(query->journal, text, MAX_KEY_LENGTH, filter, true);
+
+  filter->parenthesized = parenthesized;
+  lookup->sorted_texts[(*count)++] = text;
+  return strlen(text) < MAX_KEY_LENGTH - 1;
+}
+
+static bool build_key(Query* query, Command* command, ResultKey* key) {
+  memset(key, 0, sizeof(ResultKey));
+  key->type         = command->type;
+  key->date_present = command->date_present;
+  key->unify        = command->unify;
+  key->running      = command->running;
+
+  if (command->date_present) {
+    key->from = command->from.date;
+    key->to   = command->to.date;
+  }
+
+  // The balance view keeps every transaction in the date range, its filter only hides accounts.
+  if (command->type == COMMAND_BALANCE) {
+    key->monthly   = command->monthly;
+    key->quarterly = command->quarterly;
+    key->yearly    = command->yearly;
+    return true;
+  }
+
+  if (!command->filter) return true;
+
+  int count = 0;
+  if (!add_conjuncts(query, command->filter, &count)) return false;
+
+  char** sorted_texts = query->result->sorted_texts;
+  qsort(sorted_texts, count, sizeof(char*), compare_texts);
+
+  int length = 0;
+
+  for (int i = 0; i < count; i++) {
+    int size = strlen(sorted_texts[i]);
+    if (length + size + 1 >= MAX_KEY_LENGTH) return false;
+
+    memcpy(&key->conjuncts[length], sorted_texts[i], size);
+    length += size;
+    key->conjuncts[length++] = '\n';
+  }
+
+  key->conjunct_count = count;
+  return true;
+}
+
+static bool same_options(ResultKey* a, ResultKey* b) {
+  if (a->type != b->type || a->date_present != b->date_present) return false;
+  if (a->date_present && (!date_is_equal(&a->from, &b->from) || !date_is_equal(&a->to, &b->to))) return false;
+
+  return a->unify == b->unify && a->running == b->running && a->monthly == b->monthly && a->quarterly == b->quarterly &&
+         a->yearly == b->yearly;
+}
+
+static bool has_line(char* lines, char* line, int length) {
+  while (*lines) {
+    char* end = strchr(lines, '\n');
+    if (end - lines == length && !memcmp(lines, line, length)) return true;
+    lines = end + 1;
+  }
+
+  return false;
+}
+
+static bool is_subset(char* subset, char* set) {
+  while (*subset) {
+    char* end = strchr(subset, '\n');
+    if (!has_line(set, subset, end - subset)) return false;
+    subset = end + 1;
+  }
+
+  return true;
+}
+
+static bool is_current(Journal* journal, CachedResult* entry) {
+  return entry->last_used && entry->generation == journal->generation && entry->transaction_count == journal->raw_transaction_count;
+}
+
+int find_result(Query* query, Command* command) {
+  if (!query->result) {
+    query->result = calloc(1, sizeof(ResultLookup));
+    assert(query->result);
+  }
+
+  release_result(query);
+
+  Journal* journal = query->journal;
+  ResultCache* cache = journal->results;
+  ResultLookup* lookup = query->result;
+  ResultKey* key = &lookup->key;
+
+  lookup->current = 0;
+  lookup->found = 0;
+  lookup->key_valid = build_key(query, command, key);
+
+  if (!lookup->key_valid) return RESULT_MISS;
+
+  pthread_mutex_lock(&cache->mutex);
+  CachedResult* found = 0;
+
+  for (int i = 0; i < MAX_CACHED_RESULTS; i++) {
+    CachedResult* entry = &cache->entries[i];
+    if (!is_current(journal, entry) || !same_options(&entry->key, key)) continue;
+
+    if (!strcmp(entry->key.conjuncts, key->conjuncts)) {
+      entry->last_used = ++cache->use_counter;
+      entry->users += 2;
+      lookup->current = lookup->found = entry;
+      pthread_mutex_unlock(&cache->mutex);
+      return RESULT_HIT;
+    }
+
+    // Running sums include the transactions that are not kept, so only plain print queries are refined. The smallest superset is used.
+    bool refines = key->type == COMMAND_PRINT && !key->running && entry->key.conjunct_count < key->conjunct_count &&
+                   is_subset(entry->key.conjuncts, key->conjuncts);
+
+    if (refines && (!found || entry->row_count < found->row_count)) found = entry;
+  }
+
+  if (found) {
+    found->last_used = ++cache->use_counter;
+    found->users++;
+    lookup->found = found;
+  }
+
+  pthread_mutex_unlock(&cache->mutex);
+  return found ? RESULT_REFINE : RESULT_MISS;
+}
+
+// Unpins the entries of the command, called when it is done.
+void release_result(Query* query) {
+  ResultLookup* lookup = query->result;
+  if (!lookup || (!lookup->current && !lookup->found)) return;
+
+  ResultCache* cache = query->journal->results;
+  pthread_mutex_lock(&cache->mutex);
+  if (lookup->current) lookup->current->users--;
+  if (lookup->found)   lookup->found->users--;
+  pthread_mutex_unlock(&cache->mutex);
+
+  lookup->current = 0;
+  lookup->found = 0;
+}
+
+int get_result_row_count(Query* query) {
+  CachedResult* found = query->result->found;
+  return found ? found->row_count : 0;
+}
+
+// Stores the rows of the found entry in date order. For a hit the printed postings and the running sums of the rows, by index in
+// journal->raw_transactions, are restored into the query as well.
+int get_result_rows(Query* query, Transaction** rows, u8* sides) {
+  CachedResult* found = query->result->found;
+  bool hit = found == query->result->current;
+
+  for (int i = 0; i < found->row_count; i++) {
+    int index = found->rows[i];
+    rows[i] = &query->journal->raw_transactions[index];
+
+    if (hit) {
+      sides[index] = found->sides[i];
+      query->from_sums[index] = found->from_sums[i];
+      query->to_sums[index]   = found->to_sums[i];
+    }
+  }
+
+  return found->row_count;
+}
+
+bool get_result_periods(Query* query, Period* periods, int* period_count, double* initial_sums) {
+  CachedResult* current = query->result->current;
+  if (!current) return false;
+
+  ResultCache* cache = query->journal->results;
+  pthread_mutex_lock(&cache->mutex);
+  bool has_periods = current->has_periods;
+  pthread_mutex_unlock(&cache->mutex);
+  if (!has_periods) return false;
+
+  memcpy(periods, current->periods, current->period_count * sizeof(Period));
+  memcpy(initial_sums, current->initial_sums, sizeof(current->initial_sums));
+  *period_count = current->period_count;
+  return true;
+}
+
+// Returns 0 if every entry is pinned.
+static CachedResult* get_free_entry(Journal* journal) {
+  CachedResult* entries = journal->results->entries;
+  CachedResult* oldest = 0;
+
+  for (int i = 0; i < MAX_CACHED_RESULTS; i++) {
+    CachedResult* entry = &entries[i];
+    if (entry->users) continue;
+    if (!is_current(journal, entry)) return entry;
+    if (!oldest || entry->last_used < oldest->last_used) oldest = entry;
+  }
+
+  return oldest;
+}
+
+// Stores the kept rows of the query, in date order, after filtering.
+void store_result(Query* query, Command* command, Transaction** rows, int count, u8* sides) {
+  ResultLookup* lookup = query->result;
+  if (!lookup->key_valid) return;
+
+  Journal* journal = query->journal;
+  ResultCache* cache = journal->results;
+  pthread_mutex_lock(&cache->mutex);
+
+  CachedResult* entry = get_free_entry(journal);
+  if (!entry) {
+    pthread_mutex_unlock(&cache->mutex);
+    return;
+  }
+
+  entry->key = lookup->key;
+  entry->generation = journal->generation;
+  entry->transaction_count = journal->raw_transaction_count;
+  entry->last_used = ++cache->use_counter;
+  entry->users = 1;
+  entry->row_count = count;
+  entry->has_periods = false;
+
+  for (int i = 0; i < count; i++) {
+    int index = rows[i] - journal->raw_transactions;
+    entry->rows[i]  = index;
+    entry->sides[i] = sides[index];
+    entry->from_sums[i] = query->from_sums[index];
+    entry->to_sums[i]   = query->to_sums[index];
+  }
+
+  lookup->current = entry;
+  pthread_mutex_unlock(&cache->mutex);
+}
+
+void store_result_periods(Query* query, Period* periods, int period_count, double* initial_sums) {
+  CachedResult* current = query->result->current;
+  if (!current) return;
+
+  ResultCache* cache = query->journal->results;
+  pthread_mutex_lock(&cache->mutex);
+
+  if (!current->has_periods) {
+    memcpy(current->periods, periods, period_count * sizeof(Period));
+    memcpy(current->initial_sums, initial_sums, sizeof(current->initial_sums));
+    current->period_count = period_count;
+    current->has_periods = true;
+  }
+
+  pthread_mutex_unlock(&cache->mutex);
+}
@@ -0,0 +1,21 @@
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include "command.h"
+
+enum {
+  RESULT_MISS,
+  RESULT_HIT,    // The same query was run before.
+  RESULT_REFINE, // A cached query kept a superset, its rows are filtered again.
+};
+
+ResultCache* results_create();
+int  find_result(Query* query, Command* command);
+int  get_result_row_count(Query* query);
+int  get_result_rows(Query* query, Transaction** rows, u8* sides);
+bool get_result_periods(Query* query, Period* periods, int* period_count, double* initial_sums);
+void store_result(Query* query, Command* command, Transaction** rows, int count, u8* sides);
+void store_result_periods(Query* query, Period* periods, int period_count, double* initial_sums);
+void release_result(Query* query);
+
+#endif
@@ -0,0 +1,406 @@
+#define _GNU_SOURCE
+
+#include "server.h"
+#include "journal.h"
+#include "parser.h"
+#include "output.h"
+#include "trace.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+
+// Keeps the journal, its indices and the result caches loaded, and executes commands sent by clients over a Unix socket next to the
+// journal, such that a query does not pay for parsing the journal. A request is one line with the screen width of the client and the
+// command, the reply is the output of the command, and then the connection is closed.
+//
+// The main thread reads the requests and sends the replies of every client, on sockets that do not block, such that a slow client does
+// not hold up the others. A complete request is executed by a worker thread, with its own capture. Queries run at the same time, and
+// commands that write to the journal run alone, by the lock of the journal handle, and with other sessions by the journal lock. A
+// worker wakes up the main thread through a pipe once the reply is ready.
+
+#define MAX_CLIENTS  64
+#define WORKER_COUNT 4
+#define REQUEST_SIZE (INPUT_SIZE + 16)
+#define CAPTURE_SIZE (1 << 24)
+#define CLIENT_WIDTH 120 // When the output is not a terminal.
+
+typedef struct {
+  int file;
+  int size;
+  char request[REQUEST_SIZE];
+  bool executing; // Handed to a worker, the main thread leaves the client alone until it is executed.
+  bool executed;  // Set by the worker once the reply is ready.
+  char* reply;    // Zero while the request is read.
+  int reply_size;
+  int reply_sent;
+} Client;
+
+static Client* clients[MAX_CLIENTS];
+static int client_count;
+static CashJournal* served;
+
+// Requests waiting for a worker in arrival order, and the executed flags of the clients.
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  queue_changed = PTHREAD_COND_INITIALIZER;
+static Client* waiting[MAX_CLIENTS];
+static int waiting_count;
+static bool closing;
+
+static pthread_t workers[WORKER_COUNT];
+static int wake_pipe[2] = { -1, -1 };
+
+static volatile sig_atomic_t stopped;
+
+static void wake() {
+  char byte = 0;
+  ssize_t written = write(wake_pipe[1], &byte, 1); // A full pipe wakes up the main thread already.
+  (void)written;
+}
+
+static void handle_stop(int signal) {
+  stopped = 1;
+  wake();
+}
+
+// The socket is next to the journal, with its name followed by .socket. Returns false if the path does not fit in the address.
+static bool get_address(char* path, struct sockaddr_un* address) {
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  int size = snprintf(address->sun_path, sizeof(address->sun_path), "%s.socket", path);
+  return size < (int)sizeof(address->sun_path);
+}
+
+// Returns the connected socket, or -1 if no server is running.
+static int connect_server(char* path) {
+  struct sockaddr_un address;
+  if (!get_address(path, &address)) return -1;
+
+  int file = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (file < 0) return -1;
+
+  if (connect(file, (struct sockaddr*)&address, sizeof(address)) != 0) {
+    close(file);
+    return -1;
+  }
+
+  return file;
+}
+
+// Returns false if the other side is gone.
+static bool write_all(int file, char* data, int size) {
+  while (size > 0) {
+    int written = write(file, data, size);
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) return false;
+    data += written;
+    size -= written;
+  }
+
+  return true;
+}
+
+static void add_reply(Client* client, char* data, int size) {
+  client->reply = realloc(client->reply, client->reply_size + size + 1);
+  assert(client->reply);
+  memcpy(&client->reply[client->reply_size], data, size);
+  client->reply_size += size;
+}
+
+static void add_error(Client* client, char* message) {
+  char error[256];
+  int size = snprintf(error, sizeof(error), "   \033[31mError:\033[0m %s\n", message);
+  add_reply(client, error, size);
+}
+
+// Sends what the socket takes of the reply. Returns false when the reply is sent, or the client is gone.
+static bool send_reply(Client* client) {
+  while (client->reply_sent < client->reply_size) {
+    int written = write(client->file, &client->reply[client->reply_sent], client->reply_size - client->reply_sent);
+    if (written < 0 && errno == EINTR) continue;
+    if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+    if (written <= 0) return false;
+    client->reply_sent += written;
+  }
+
+  return false;
+}
+
+static void serve(Client* client, Capture* capture) {
+  int width, n;
+
+  if (sscanf(client->request, "%d %n", &width, &n) != 1 || width <= 0) {
+    add_error(client, "invalid request");
+    return;
+  }
+
+  trace_begin("request");
+
+  capture_output(capture);
+  cash_execute(served, &client->request[n], width);
+  capture_output(0);
+
+  trace_end("request");
+
+  add_reply(client, capture->data, capture->size);
+  if (capture->overflow) add_error(client, "the output was too large");
+}
+
+static void* worker_main(void* argument) {
+  Capture capture = { .data = malloc(CAPTURE_SIZE), .capacity = CAPTURE_SIZE };
+  assert(capture.data);
+
+  while (true) {
+    pthread_mutex_lock(&queue_mutex);
+    while (!waiting_count && !closing) pthread_cond_wait(&queue_changed, &queue_mutex);
+
+    if (!waiting_count) {
+      pthread_mutex_unlock(&queue_mutex);
+      break;
+    }
+
+    Client* client = waiting[0];
+    memmove(&waiting[0], &waiting[1], --waiting_count * sizeof(Client*));
+    pthread_mutex_unlock(&queue_mutex);
+
+    serve(client, &capture);
+
+    pthread_mutex_lock(&queue_mutex);
+    client->executed = true;
+    pthread_mutex_unlock(&queue_mutex);
+    wake();
+  }
+
+  free(capture.data);
+  return 0;
+}
+
+static void execute_request(Client* client) {
+  client->executing = true;
+
+  pthread_mutex_lock(&queue_mutex);
+  waiting[waiting_count++] = client;
+  pthread_cond_signal(&queue_changed);
+  pthread_mutex_unlock(&queue_mutex);
+}
+
+static void remove_client(int index) {
+  close(clients[index]->file);
+  free(clients[index]->reply);
+  free(clients[index]);
+  clients[index] = clients[--client_count];
+}
+
+// Reads what the client sent, and hands the request to a worker once its line is complete. Returns false when the client is done.
+static bool read_request(Client* client) {
+  int size = read(client->file, &client->request[client->size], REQUEST_SIZE - 1 - client->size);
+  if (size < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+  if (size <= 0) return false;
+
+  client->size += size;
+  client->request[client->size] = 0;
+
+  char* end = strchr(client->request, '\n');
+  if (!end && client->size < REQUEST_SIZE - 1) return true;
+
+  if (!end) {
+    add_error(client, "the command is too long");
+    return send_reply(client);
+  }
+
+  *end = 0;
+  execute_request(client);
+  return true;
+}
+
+// Takes the replies that the workers finished, and starts sending them. Returns false when a client is done.
+static bool take_reply(Client* client) {
+  pthread_mutex_lock(&queue_mutex);
+  bool executed = client->executed;
+  pthread_mutex_unlock(&queue_mutex);
+  if (!executed) return true;
+
+  client->executing = false;
+  client->executed = false;
+  if (!client->reply) add_reply(client, "", 0);
+  return send_reply(client);
+}
+
+static void stop_workers(int count) {
+  pthread_mutex_lock(&queue_mutex);
+  closing = true;
+  pthread_cond_broadcast(&queue_changed);
+  pthread_mutex_unlock(&queue_mutex);
+
+  for (int i = 0; i < count; i++) pthread_join(workers[i], 0);
+}
+
+// Returns the listening socket, or -1 with the error printed.
+static int listen_server(char* path, struct sockaddr_un* address) {
+  if (!get_address(path, address)) {
+    fprintf(stderr, "The socket path %s.socket is too long\n", path);
+    return -1;
+  }
+
+  int listener = connect_server(path);
+  if (listener >= 0) {
+    close(listener);
+    fprintf(stderr, "A server is already running on %s.socket\n", path);
+    return -1;
+  }
+
+  unlink(address->sun_path); // Left by a server that did not stop.
+
+  listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listener >= 0 && bind(listener, (struct sockaddr*)address, sizeof(*address)) == 0 && listen(listener, MAX_CLIENTS) == 0)
+    return listener;
+
+  fprintf(stderr, "Can not listen on %s: %s\n", address->sun_path, strerror(errno));
+  if (listener >= 0) close(listener);
+  return -1;
+}
+
+void server_run(CashJournal* journal, char* path) {
+  served = journal;
+
+  struct sockaddr_un address;
+  int listener = listen_server(path, &address);
+  if (listener < 0) return;
+
+  if (pipe2(wake_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+    fprintf(stderr, "Can not create a pipe: %s\n", strerror(errno));
+    close(listener);
+    unlink(address.sun_path);
+    return;
+  }
+
+  signal(SIGPIPE, SIG_IGN); // A client that leaves early is noticed by the failing write.
+  signal(SIGINT,  handle_stop);
+  signal(SIGTERM, handle_stop);
+
+  int worker_count = 0;
+  while (worker_count < WORKER_COUNT && pthread_create(&workers[worker_count], 0, worker_main, 0) == 0) worker_count++;
+  if (!worker_count) {
+    fprintf(stderr, "Can not start the workers\n");
+    stopped = 1;
+  }
+
+  struct pollfd files[MAX_CLIENTS + 2];
+  Client* polled[MAX_CLIENTS];
+
+  while (!stopped) {
+    files[0] = (struct pollfd) { listener, POLLIN, 0 };
+    files[1] = (struct pollfd) { wake_pipe[0], POLLIN, 0 };
+    int count = 0;
+
+    for (int i = 0; i < client_count; i++) {
+      Client* client = clients[i];
+      if (client->executing) continue;
+      files[count + 2] = (struct pollfd) { client->file, client->reply ? POLLOUT : POLLIN, 0 };
+      polled[count++] = client;
+    }
+
+    if (poll(files, count + 2, -1) < 0) {
+      assert(errno == EINTR);
+      continue;
+    }
+
+    if (files[1].revents & POLLIN) {
+      char buffer[64];
+      while (read(wake_pipe[0], buffer, sizeof(buffer)) > 0) {}
+    }
+
+    // Backwards, since a removed client is replaced by the last one.
+    for (int i = client_count - 1; i >= 0; i--) {
+      Client* client = clients[i];
+      bool keep = true;
+
+      if (client->executing) {
+        keep = take_reply(client);
+      } else {
+        int index = 0;
+        while (index < count && polled[index] != client) index++;
+        if (index < count && files[index + 2].revents) keep = client->reply ? send_reply(client) : read_request(client);
+      }
+
+      if (!keep) remove_client(i);
+    }
+
+    if ((files[0].revents & POLLIN) && client_count < MAX_CLIENTS) {
+      int file = accept4(listener, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+      if (file >= 0) {
+        Client* client = calloc(1, sizeof(Client));
+        assert(client);
+        client->file = file;
+        clients[client_count++] = client;
+      }
+    }
+  }
+
+  // The workers finish the requests they have, the replies are not sent.
+  stop_workers(worker_count);
+  for (int i = client_count - 1; i >= 0; i--) remove_client(i);
+  close(listener);
+  close(wake_pipe[0]);
+  close(wake_pipe[1]);
+  unlink(address.sun_path);
+}
+
+// Sends the command to the server and writes the output. Without a server the journal is parsed and the command executed here.
+void client_run(char* path, char* command) {
+  int width = CLIENT_WIDTH;
+  struct winsize size;
+  if (isatty(STDOUT_FILENO) && ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col) width = size.ws_col;
+
+  int file = connect_server(path);
+
+  if (file < 0) {
+    CashJournal* journal = cash_open(path);
+    if (!journal) {
+      fprintf(stderr, "Can not read the journal %s\n", path);
+      return;
+    }
+
+    cash_execute(journal, command, width);
+    cash_close(journal);
+    return;
+  }
+
+  signal(SIGPIPE, SIG_IGN); // A server that stops early is noticed by the failing write.
+
+  char request[REQUEST_SIZE];
+  int request_size = snprintf(request, sizeof(request), "%d %s\n", width, command);
+
+  if (request_size >= REQUEST_SIZE) {
+    fprintf(stderr, "The command is too long\n");
+    close(file);
+    return;
+  }
+
+  if (!write_all(file, request, request_size)) {
+    fprintf(stderr, "The server closed the connection\n");
+    close(file);
+    return;
+  }
+
+  char buffer[1 << 16];
+
+  while (true) {
+    int size = read(file, buffer, sizeof(buffer));
+    if (size < 0 && errno == EINTR) continue;
+    if (size <= 0) break;
+    write_all(STDOUT_FILENO, buffer, size);
+  }
+
+  close(file);
+}
@@ -0,0 +1,9 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "cash.h"
+
+void server_run(CashJournal* journal, char* path);
+void client_run(char* path, char* command);
+
+#endif
@@ -0,0 +1,97 @@
+#include "speculation.h"
+#include "output.h"
+#include "parser.h"
+#include "trace.h"
+#include "stats.h"
+#include "archive.h"
+#include <pthread.h>
+#include <string.h>
+#include <assert.h>
+
+// Executes the command that is being typed on a background thread whenever the input parses, and keeps its output in memory. When
+// Enter is pressed for the same input the output is written at once. A keystroke that changes the input cancels the execution. The
+// speculation has its own query context, but it is always finished before the main thread parses the journal or executes anything,
+// since they share the journal with its indices and caches.
+
+#define CAPTURE_SIZE (1 << 24)
+
+static char output[CAPTURE_SIZE];
+static Capture capture = { .data = output, .capacity = CAPTURE_SIZE };
+
+static Query* query;
+static char text[INPUT_SIZE]; // Input that the command was parsed from, empty when there is no speculation.
+static int width, height;     // Screen size when the command was executed, the layout depends on it.
+static pthread_t thread;
+static bool running;  // Started and not joined.
+static bool complete; // Executed to the end without being cancelled.
+static QueryStats stats; // Of the execution, published when the output is printed.
+
+static void* speculation_main(void* argument) {
+  trace_begin("speculation");
+
+  set_size(width, height);
+  capture_output(&capture);
+  execute_command(query, &query->options);
+  capture_output(0);
+  complete = stats_take_query(&stats) && !query->cancelled && !capture.overflow;
+
+  trace_end("speculation");
+  return 0;
+}
+
+static void join() {
+  if (!running) return;
+  assert(pthread_join(thread, 0) == 0);
+  running = false;
+}
+
+// Starts if the input parses as a query that can run in the background. Parsing archived transactions changes the journal, which is
+// only done by the executed command.
+void speculation_start(Journal* journal, char* input) {
+  speculation_stop();
+
+  if (!query) query = query_create(journal);
+  if (!parse_command_line(query, input, PARSE_SPECULATIVE) || archive_needs_load(journal, &query->options)) return;
+
+  get_size(&width, &height);
+  strcpy(text, input);
+  complete = false;
+  running = true;
+  assert(pthread_create(&thread, 0, speculation_main, 0) == 0);
+}
+
+void speculation_stop() {
+  if (running) {
+    query->cancelled = 1;
+    join();
+    query->cancelled = 0;
+  }
+
+  text[0] = 0;
+  complete = false;
+}
+
+bool speculation_matches(char* input) {
+  int screen_width, screen_height;
+  get_size(&screen_width, &screen_height);
+
+  return text[0] && !strcmp(text, input) && screen_width == width;
+}
+
+// Waits for the speculation of the input to finish. Returns false, with the speculation stopped, if it is not usable.
+bool speculation_ready(char* input) {
+  if (speculation_matches(input)) {
+    join();
+    if (complete) return true;
+  }
+
+  speculation_stop();
+  return false;
+}
+
+void print_speculation() {
+  write_capture(&capture);
+  stats_publish(&stats);
+  text[0] = 0;
+  complete = false;
+}
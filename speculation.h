@@ -0,0 +1,12 @@
+#ifndef SPECULATION_H
+#define SPECULATION_H
+
+#include "command.h"
+
+void speculation_start(Journal* journal, char* text);
+void speculation_stop();
+bool speculation_matches(char* text);
+bool speculation_ready(char* text);
+void print_speculation();
+
+#endif
@@ -0,0 +1,223 @@
+#include "stats.h"
+#include "output.h"
+#include "trace.h"
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define STATS_WINDOW  64 // Number of samples kept per stage for the latency histograms.
+#define BUCKET_COUNT  20 // Buckets of 1, 2 and 5 times a power of ten from 1 us to 1 s, plus overflow.
+#define LEFT_INDENTATION 3
+
+static char* stage_names[STAGE_COUNT] = {
+  "parse",
+  "keystroke",
+  "query",
+  "sort",
+  "plan",
+  "filter",
+  "order",
+  "periods",
+  "layout",
+  "flush",
+};
+
+// The stats of a query are kept by the thread that executes it, and published with the samples of its stages when its output is shown.
+// A speculative execution may be cancelled, or its output never shown, and then it is not counted.
+static __thread u64 stage_start[STAGE_COUNT];
+static __thread QueryStats current;
+static __thread QueryStats finished; // The last query of the thread that was executed to the end and not yet taken.
+static __thread bool finished_valid;
+static __thread u64 total_bytes;
+static __thread u64 query_start_bytes;
+
+// The published stats are shared by the threads that show query output, like the session and the server workers.
+static pthread_mutex_t published_mutex = PTHREAD_MUTEX_INITIALIZER;
+static u64 samples[STAGE_COUNT][STATS_WINDOW];
+static int sample_count[STAGE_COUNT];
+static int sample_position[STAGE_COUNT];
+
+static QueryStats last;
+static bool last_valid;
+
+u64 stats_now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (u64)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static void add_sample(int stage, u64 time) {
+  pthread_mutex_lock(&published_mutex);
+  samples[stage][sample_position[stage]++] = time;
+  if (sample_position[stage] == STATS_WINDOW) sample_position[stage] = 0;
+  if (sample_count[stage] < STATS_WINDOW) sample_count[stage]++;
+  pthread_mutex_unlock(&published_mutex);
+}
+
+void stats_begin(int stage) {
+  if (stage == STAGE_QUERY) {
+    memset(&current, 0, sizeof(current));
+    finished_valid = false;
+    query_start_bytes = total_bytes;
+  }
+
+  trace_begin(stage_names[stage]);
+  stage_start[stage] = stats_now();
+}
+
+void stats_end(int stage) {
+  trace_end(stage_names[stage]);
+
+  u64 time = stats_now() - stage_start[stage];
+  current.time[stage] += time;
+  current.stages |= 1 << stage;
+
+  // Parsing and keystrokes only happen on the main thread, outside of queries.
+  if (stage < STAGE_QUERY) add_sample(stage, time);
+
+  if (stage == STAGE_QUERY) {
+    current.bytes_written = total_bytes - query_start_bytes;
+    finished = current;
+    finished_valid = true;
+  }
+}
+
+void stats_cancel_query() {
+  finished_valid = false;
+}
+
+void stats_count_rows(int scanned, int kept) {
+  current.rows_scanned += scanned;
+  current.rows_kept    += kept;
+}
+
+void stats_add_bytes(int count) {
+  total_bytes += count;
+}
+
+bool stats_take_query(QueryStats* stats) {
+  if (!finished_valid) return false;
+  *stats = finished;
+  finished_valid = false;
+  return true;
+}
+
+void stats_publish(QueryStats* stats) {
+  pthread_mutex_lock(&published_mutex);
+  last = *stats;
+  last_valid = true;
+  pthread_mutex_unlock(&published_mutex);
+
+  for (int i = STAGE_QUERY; i < STAGE_COUNT; i++) {
+    if (stats->stages & (1 << i)) add_sample(i, stats->time[i]);
+  }
+}
+
+static double to_ms(u64 time) {
+  return (double)time / 1000000.0;
+}
+
+static int compare_samples(const void* a, const void* b) {
+  u64 x = *(u64*)a;
+  u64 y = *(u64*)b;
+  return (x > y) - (x < y);
+}
+
+// The upper limit of each bucket in microseconds, the last bucket has the samples of 1 s and above.
+static u64 bucket_limits[BUCKET_COUNT - 1] = {
+  1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000,
+};
+
+static int get_bucket(u64 time) {
+  u64 us = time / 1000;
+  int bucket = 0;
+  while (bucket < BUCKET_COUNT - 1 && us >= bucket_limits[bucket]) bucket++;
+  return bucket;
+}
+
+static void print_bucket_limit(int bucket) {
+  if (bucket == BUCKET_COUNT - 1) {
+    print(">=1s");
+    return;
+  }
+
+  u64 us = bucket_limits[bucket];
+  if (us >= 1000000) {
+    print("<%llus", (unsigned long long)(us / 1000000));
+  } else if (us >= 1000) {
+    print("<%llums", (unsigned long long)(us / 1000));
+  } else {
+    print("<%lluus", (unsigned long long)us);
+  }
+}
+
+static void start_line() {
+  set_x_cursor(LEFT_INDENTATION);
+}
+
+static void print_query(QueryStats* stats) {
+  for (int i = STAGE_QUERY; i < STAGE_COUNT; i++) {
+    start_line();
+    print("%-16s %10.3lf ms\n", stage_names[i], to_ms(stats->time[i]));
+  }
+
+  start_line();
+  print("%-16s %10d\n",   "rows scanned",  stats->rows_scanned);
+  start_line();
+  print("%-16s %10d\n",   "rows kept",     stats->rows_kept);
+  start_line();
+  print("%-16s %10llu\n", "bytes written", (unsigned long long)stats->bytes_written);
+}
+
+// Prints the breakdown of the query that the thread executed last.
+void print_query_stats() {
+  print_query(&current);
+}
+
+// Prints the breakdown of the last shown query, followed by latency histograms over the last samples of each stage.
+void print_stats() {
+  pthread_mutex_lock(&published_mutex);
+  QueryStats shown = last;
+  bool shown_valid = last_valid;
+  u64 shown_samples[STAGE_COUNT][STATS_WINDOW];
+  int shown_counts[STAGE_COUNT];
+  memcpy(shown_samples, samples, sizeof(samples));
+  memcpy(shown_counts, sample_count, sizeof(sample_count));
+  pthread_mutex_unlock(&published_mutex);
+
+  if (shown_valid) {
+    print_query(&shown);
+  } else {
+    start_line();
+    print("No queries executed\n");
+  }
+
+  print("\n");
+  start_line();
+  print("%-16s %6s %10s %10s %10s   histogram (last %d)\n", "latency", "count", "p50 ms", "p90 ms", "max ms", STATS_WINDOW);
+
+  for (int i = 0; i < STAGE_COUNT; i++) {
+    int count = shown_counts[i];
+    if (count == 0) continue;
+
+    u64 sorted[STATS_WINDOW];
+    memcpy(sorted, shown_samples[i], count * sizeof(u64));
+    qsort(sorted, count, sizeof(u64), compare_samples);
+
+    start_line();
+    print("%-16s %6d %10.3lf %10.3lf %10.3lf  ", stage_names[i], count, to_ms(sorted[count / 2]), to_ms(sorted[(count * 9) / 10]), to_ms(sorted[count - 1]));
+
+    int buckets[BUCKET_COUNT] = { 0 };
+    for (int j = 0; j < count; j++) buckets[get_bucket(sorted[j])]++;
+
+    for (int j = 0; j < BUCKET_COUNT; j++) {
+      if (buckets[j] == 0) continue;
+      print(" ");
+      print_bucket_limit(j);
+      print(":%d", buckets[j]);
+    }
+
+    print("\n");
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "basic.h"
+#include <stdbool.h>
+
+enum {
+  STAGE_PARSE,
+  STAGE_KEYSTROKE,
+  STAGE_QUERY,
+  STAGE_SORT,
+  STAGE_PLAN,
+  STAGE_FILTER,
+  STAGE_ORDER,
+  STAGE_PERIODS,
+  STAGE_LAYOUT,
+  STAGE_FLUSH,
+  STAGE_COUNT,
+};
+
+typedef struct {
+  u64 time[STAGE_COUNT]; // Nanoseconds.
+  u32 stages;            // Bit for each stage that was timed.
+  int rows_scanned;
+  int rows_kept;
+  u64 bytes_written;
+} QueryStats;
+
+u64  stats_now();
+void stats_begin(int stage);
+void stats_end(int stage);
+void stats_cancel_query();
+void stats_count_rows(int scanned, int kept);
+void stats_add_bytes(int count);
+
+// Takes the stats of the last query that the calling thread executed to the end. Returns false if there is none.
+bool stats_take_query(QueryStats* stats);
+// Makes the query the last one for the stats command and adds the samples of its stages. Called by the thread that shows the output of
+// the query, when it is shown.
+void stats_publish(QueryStats* stats);
+void print_query_stats();
+void print_stats();
+
+#endif
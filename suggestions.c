@@ -6,7 +6,9 @@
 #include "journal.h"
 #include "terminal.h"
 #include "assert.h"
+#include "description.h"
 #include <string.h>
+#include <stdlib.h>
 
 #define MAX_VIEWED_SUGGESTIONS 3
 #define MAX_SUGGESTIONS        32
@@ -103,9 +105,9 @@ void print_suggestions() {
   if (print_count) cursor_up(print_count);
 }
 
-void suggest_account(char* name, bool allow_cathegories) {
-  for (int i = 0; i < journal.account_count; i++) {
-    Account* account = &journal.accounts[i];
+void suggest_account(Journal* journal, char* name, bool allow_cathegories) {
+  for (int i = 0; i < journal->account_count; i++) {
+    Account* account = &journal->accounts[i];
     if (allow_cathegories == false && account->is_category) continue;
     if (strcasestr(account->path, name)) {
       if (!add_suggestion("%s", account->path)) return;
@@ -113,21 +115,19 @@ void suggest_account(char* name, bool allow_cathegories) {
   }
 }
 
-void suggest_description(char* name) {
-  for (int i = 0; i < journal.raw_transaction_count; i++) {
-    char* desc = journal.raw_transactions[i].description;
-    if (!desc) continue;
-
-    if (strcasestr(desc, name)) {
-      bool unique = true;
-      for (int j = 0; j < count; j++) {
-        if (!strcmp(buffer[j], desc)) {
-          unique = false;
-          break;
-        }
-      }
-
-      if (unique && !add_suggestion(desc)) break;
-    }
+static int compare_ids(const void* a, const void* b) {
+  return *(int*)a - *(int*)b;
+}
+
+// Descriptions are interned in journal order, so suggesting them by index keeps the order of their first use.
+void suggest_description(Journal* journal, char* name) {
+  static int ids[MAX_DESCRIPTIONS];
+  int match_count = search_descriptions(journal, name, ids);
+
+  qsort(ids, match_count, sizeof(int), compare_ids);
+
+  for (int i = 0; i < match_count; i++) {
+    Description* description = get_description(journal, ids[i]);
+    if (!add_suggestion("%.*s", description->length, description->string)) break;
   }
 }
@@ -3,6 +3,7 @@
 
 #include "stdarg.h"
 #include <stdbool.h>
+#include "journal.h"
 
 void suggestion_down();
 void suggestion_up();
@@ -15,7 +16,7 @@ char* get_suggestion();
 void  print_suggestions();
 void  clear_suggestions();
 
-void suggest_account(char* name, bool allow_cathegories);
-void suggest_description(char* name);
+void suggest_account(Journal* journal, char* name, bool allow_cathegories);
+void suggest_description(Journal* journal, char* name);
 
 #endif
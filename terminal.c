@@ -1,4 +1,5 @@
 #include "terminal.h"
+#include "trace.h"
 #include <termios.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,29 +10,8 @@
 #include <signal.h>
 #include <string.h>
 
-#define OUTPUT_BUFFER_SIZE (4096 * 4096 * 16)
-static char output_buffer[OUTPUT_BUFFER_SIZE];
-static int  output_size;
-
 static void handle_resize();
 
-int print(const char* text, ...) {
-  if (output_size + 4000 > OUTPUT_BUFFER_SIZE) {
-    flush();
-  }
-  va_list arguments;
-  va_start(arguments, text);
-  int size = vsnprintf(&output_buffer[output_size], OUTPUT_BUFFER_SIZE - output_size, text, arguments);
-  va_end(arguments);
-  output_size += size;
-  return size;
-}
-
-void flush() {
-  assert(write(STDOUT_FILENO, output_buffer, output_size) == output_size);
-  output_size = 0;
-}
-
 struct termios default_terminal;
 
 void terminal_reset() {
@@ -39,6 +19,8 @@ void terminal_reset() {
 }
 
 void terminal_init() {
+  trace_begin("terminal_init");
+
   setvbuf(stdout, NULL, _IONBF, 0);
   tcgetattr(STDIN_FILENO, &default_terminal);
   struct termios terminal = default_terminal;
@@ -55,9 +37,12 @@ void terminal_init() {
   handle_resize();
   cursor_style_line();
   flush();
+
+  trace_end("terminal_init");
 }
 
 static void get_cursor_now(int* x, int* y) {
+  trace_begin("cursor probe");
   printf("\033[6n");
 
   char data[32];
@@ -75,6 +60,8 @@ static void get_cursor_now(int* x, int* y) {
   assert(sscanf(&data[2], "%d;%d", y, x) == 2);
   *x -= 1;
   *y -= 1;
+
+  trace_end("cursor probe");
 }
 
 static void set_cursor_now(int x, int y) {
@@ -89,13 +76,8 @@ void get_size_internal(int* width, int* height) {
   set_cursor_now(x, y);
 }
 
-static int screen_height, screen_width;
-
 static void handle_resize() {
-  get_size_internal(&screen_width, &screen_height);
-}
-
-void get_size(int* width, int* height) {
-  *width  = screen_width;
-  *height = screen_height;
+  int width, height;
+  get_size_internal(&width, &height);
+  set_size(width, height);
 }
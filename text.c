@@ -70,14 +70,15 @@ bool skip_string(char** cursor, char* data) {
   return true;
 }
 
+// Uses strtol rather than sscanf, which measures the length of the whole remaining input first.
 int get_number(char** cursor) {
   skip_blank(cursor);
 
-  int n;
-  int value;
-  assert(sscanf(*cursor, "%d%n", &value, &n) == 1);
-  
-  *cursor += n;
+  char* end;
+  int value = (int)strtol(*cursor, &end, 10);
+  assert(end != *cursor);
+
+  *cursor = end;
 
   return value;
 }
@@ -122,7 +123,7 @@ char* get_quoted_string(char** cursor) {
   char* start = data;
 
   while (*data && *data != '\'') data++;
-  assert(*data);
+  if (!*data) return 0;
 
   *data++ = 0;
   *cursor = data;
@@ -130,6 +131,25 @@ char* get_quoted_string(char** cursor) {
   return start; 
 }
 
+// Like get_quoted_string, but without terminating the string, such that the input can be read only.
+char* get_quoted_string_size(char** cursor, int* size) {
+  skip_blank(cursor);
+
+  char* data = *cursor;
+
+  if (*data++ != '\'') return 0;
+
+  char* start = data;
+
+  while (*data && *data != '\'') data++;
+  if (!*data) return 0;
+
+  *size = data - start;
+  *cursor = data + 1;
+
+  return start;
+}
+
 char* get_string_size(char** cursor, int* size) {
   skip_blank(cursor);
 
@@ -16,5 +16,6 @@ double get_double(char** cursor);
 char* get_string(char** cursor);
 char* get_string_size(char** cursor, int* size);
 char* get_quoted_string(char** cursor);
+char* get_quoted_string_size(char** cursor, int* size);
 
 #endif
@@ -0,0 +1,64 @@
+#include "trace.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#define MAX_TRACE_EVENTS (1 << 20)
+
+typedef struct {
+  const char* name;
+  u64  time;
+  int  thread;
+  char phase;
+} TraceEvent;
+
+bool trace_enabled;
+
+static char* trace_path;
+static TraceEvent* events;
+static int event_count;
+static int thread_count;
+static u64 start_time;
+
+static __thread int thread_id;
+
+static void trace_dump() {
+  FILE* file = fopen(trace_path, "w");
+  if (!file) return;
+
+  int count = min(event_count, MAX_TRACE_EVENTS);
+
+  fprintf(file, "{\"traceEvents\":[\n");
+  for (int i = 0; i < count; i++) {
+    TraceEvent* event = &events[i];
+    fprintf(file, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3lf,\"pid\":1,\"tid\":%d}%s\n", event->name, event->phase, (double)(event->time - start_time) / 1000.0, event->thread, (i + 1 < count) ? "," : "");
+  }
+  fprintf(file, "]}\n");
+
+  fclose(file);
+}
+
+void trace_init() {
+  trace_path = getenv("CASH_TRACE");
+  if (!trace_path || !*trace_path) return;
+
+  events = malloc(MAX_TRACE_EVENTS * sizeof(TraceEvent));
+  if (!events) return;
+
+  start_time = stats_now();
+  trace_enabled = true;
+  atexit(trace_dump);
+}
+
+void trace_event(const char* name, char phase) {
+  if (!thread_id) thread_id = __atomic_add_fetch(&thread_count, 1, __ATOMIC_RELAXED);
+
+  int index = __atomic_fetch_add(&event_count, 1, __ATOMIC_RELAXED);
+  if (index >= MAX_TRACE_EVENTS) return;
+
+  TraceEvent* event = &events[index];
+  event->name   = name;
+  event->time   = stats_now();
+  event->thread = thread_id;
+  event->phase  = phase;
+}
@@ -0,0 +1,21 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "basic.h"
+#include <stdbool.h>
+
+extern bool trace_enabled;
+
+void trace_init();
+void trace_event(const char* name, char phase);
+
+// Records begin and end events in memory. The trace is written as Chrome trace-event JSON on exit, when CASH_TRACE is set to the output path.
+static inline void trace_begin(const char* name) {
+  if (trace_enabled) trace_event(name, 'B');
+}
+
+static inline void trace_end(const char* name) {
+  if (trace_enabled) trace_event(name, 'E');
+}
+
+#endif
@@ -0,0 +1,66 @@
+#include "watch.h"
+#include "add.h"
+#include "basic.h"
+#include "journal.h"
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+
+// Watches the journal and the references directory with inotify, such that changes made by other programs are picked up by the running
+// session. Editors often save by replacing the file, so the directory of the journal is watched instead of the file. The events are
+// only hints, the journal itself finds out what changed.
+
+static int watch_file = -1;
+static int journal_watch = -1;
+static int refs_watch = -1;
+static char journal_name[PATH_MAX]; // The journal and its archive start with this name.
+
+void watch_init(char* path) {
+  char directory[PATH_MAX];
+  snprintf(directory, sizeof(directory), "%s", path);
+
+  char* slash = strrchr(directory, '/');
+  if (slash) {
+    snprintf(journal_name, sizeof(journal_name), "%s", slash + 1);
+    if (slash == directory) slash++;
+    *slash = 0;
+  } else {
+    snprintf(journal_name, sizeof(journal_name), "%s", directory);
+    strcpy(directory, ".");
+  }
+
+  watch_file = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watch_file < 0) return;
+
+  u32 changes = IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+  journal_watch = inotify_add_watch(watch_file, directory, changes);
+  refs_watch    = inotify_add_watch(watch_file, REFS_PATH, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+}
+
+// Reads the pending events without waiting. Returns true if the journal or the archive may have changed.
+bool watch_poll() {
+  if (watch_file < 0) return false;
+
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool changed = false;
+  int length = strlen(journal_name);
+
+  while (true) {
+    ssize_t size = read(watch_file, buffer, sizeof(buffer));
+    if (size <= 0) break;
+
+    for (char* cursor = buffer; cursor < buffer + size;) {
+      struct inotify_event* event = (struct inotify_event*)cursor;
+      cursor += sizeof(struct inotify_event) + event->len;
+
+      if (event->wd == refs_watch) {
+        add_references_changed();
+      } else if (event->wd == journal_watch && event->len && !strncmp(event->name, journal_name, length)) {
+        changed = true;
+      }
+    }
+  }
+
+  return changed;
+}
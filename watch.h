@@ -0,0 +1,9 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+
+void watch_init(char* path);
+bool watch_poll();
+
+#endif